@@ -0,0 +1,173 @@
+/*
+**  hoedown_alloc.c -- allocator for the hoedown sources
+*/
+
+#include "hoedown_alloc.h"
+
+/* the real ones, here */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef strdup
+
+#if defined(__GNUC__)
+#  define HOEDOWN_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#  define HOEDOWN_THREAD_LOCAL __declspec(thread)
+#endif
+
+/* every block starts with its size and the pool it comes from */
+typedef struct {
+    apr_size_t size;
+    apr_pool_t *pool;
+} hoedown_block_t;
+
+#define HOEDOWN_BLOCK_SIZE APR_ALIGN_DEFAULT(sizeof(hoedown_block_t))
+#define HOEDOWN_BLOCK(ptr) \
+    ((hoedown_block_t *)((char *)(ptr) - HOEDOWN_BLOCK_SIZE))
+#define HOEDOWN_BLOCK_DATA(block) \
+    ((void *)((char *)(block) + HOEDOWN_BLOCK_SIZE))
+
+#ifdef HOEDOWN_THREAD_LOCAL
+static HOEDOWN_THREAD_LOCAL apr_pool_t *hoedown_arena = NULL;
+#endif
+
+apr_pool_t *
+hoedown_arena_set(apr_pool_t *p)
+{
+#ifdef HOEDOWN_THREAD_LOCAL
+    apr_pool_t *prev = hoedown_arena;
+
+    hoedown_arena = p;
+
+    return prev;
+#else
+    /* no thread local storage: always the heap */
+    (void)p;
+    return NULL;
+#endif
+}
+
+static hoedown_block_t *
+block_new(apr_pool_t *p, apr_size_t size)
+{
+    hoedown_block_t *block;
+
+    if (p) {
+        block = apr_palloc(p, HOEDOWN_BLOCK_SIZE + size);
+    } else {
+        block = malloc(HOEDOWN_BLOCK_SIZE + size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    block->size = size;
+    block->pool = p;
+
+    return block;
+}
+
+void *
+hoedown_arena_malloc(size_t size)
+{
+    hoedown_block_t *block;
+
+#ifdef HOEDOWN_THREAD_LOCAL
+    block = block_new(hoedown_arena, size);
+#else
+    block = block_new(NULL, size);
+#endif
+    if (block == NULL) {
+        return NULL;
+    }
+
+    return HOEDOWN_BLOCK_DATA(block);
+}
+
+void *
+hoedown_arena_calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size && nmemb > (size_t)-1 / size) {
+        return NULL;
+    }
+
+    ptr = hoedown_arena_malloc(nmemb * size);
+    if (ptr) {
+        memset(ptr, 0, nmemb * size);
+    }
+
+    return ptr;
+}
+
+/*
+ * Pool blocks are never given back, so they grow geometrically: the
+ * buffers grow by a fixed unit, which would otherwise leave a copy of
+ * every intermediate size in the pool.
+ */
+void *
+hoedown_arena_realloc(void *ptr, size_t size)
+{
+    hoedown_block_t *block, *grown;
+    apr_size_t asize;
+
+    if (ptr == NULL) {
+        return hoedown_arena_malloc(size);
+    }
+
+    block = HOEDOWN_BLOCK(ptr);
+
+    if (block->pool == NULL) {
+        grown = realloc(block, HOEDOWN_BLOCK_SIZE + size);
+        if (grown == NULL) {
+            return NULL;
+        }
+        grown->size = size;
+        return HOEDOWN_BLOCK_DATA(grown);
+    }
+
+    if (size <= block->size) {
+        return ptr;
+    }
+
+    asize = block->size * 2;
+    if (asize < size) {
+        asize = size;
+    }
+
+    grown = block_new(block->pool, asize);
+    memcpy(HOEDOWN_BLOCK_DATA(grown), ptr, block->size);
+
+    return HOEDOWN_BLOCK_DATA(grown);
+}
+
+void
+hoedown_arena_free(void *ptr)
+{
+    hoedown_block_t *block;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    block = HOEDOWN_BLOCK(ptr);
+    if (block->pool == NULL) {
+        free(block);
+    }
+}
+
+char *
+hoedown_arena_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *ptr = hoedown_arena_malloc(len);
+
+    if (ptr) {
+        memcpy(ptr, s, len);
+    }
+
+    return ptr;
+}
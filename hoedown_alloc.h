@@ -0,0 +1,37 @@
+/*
+**  hoedown_alloc.h -- allocator for the hoedown sources
+**
+**  Included ahead of every hoedown source file (-include) with
+**  HOEDOWN_ALLOC_WRAP defined: malloc and friends are routed to the arena
+**  of the calling thread when one is set, to the heap otherwise. Arena
+**  blocks come from an apr pool and are released with it; free() on them
+**  does nothing.
+*/
+
+#ifndef HOEDOWN_ALLOC_H
+#define HOEDOWN_ALLOC_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* apr */
+#include "apr_pools.h"
+
+void *hoedown_arena_malloc(size_t size);
+void *hoedown_arena_calloc(size_t nmemb, size_t size);
+void *hoedown_arena_realloc(void *ptr, size_t size);
+void hoedown_arena_free(void *ptr);
+char *hoedown_arena_strdup(const char *s);
+
+/* set the arena of the calling thread (NULL: heap), returns the previous */
+apr_pool_t *hoedown_arena_set(apr_pool_t *p);
+
+#ifdef HOEDOWN_ALLOC_WRAP
+#  define malloc  hoedown_arena_malloc
+#  define calloc  hoedown_arena_calloc
+#  define realloc hoedown_arena_realloc
+#  define free    hoedown_arena_free
+#  define strdup  hoedown_arena_strdup
+#endif
+
+#endif /* HOEDOWN_ALLOC_H */
@@ -0,0 +1,742 @@
+/*
+**  hoedown_bench.c -- render micro-benchmark for mod_hoedown
+**
+**    % make bench
+**    % ./hoedown-bench [-n ITERATIONS] [-s STYLE] [-H] [FILE...]
+**    % ./hoedown-bench -S [-n ITERATIONS] [FILE...]
+**    % ./hoedown-bench -C [FILE...]
+**
+**  Runs the handler's render path outside of httpd: the markdown file is
+**  read into the input buffer, then the style header, the toc and body
+**  render and the style footer are written to the page buffer.
+**
+**  Without FILE, a generated corpus of small, medium and large documents
+**  is used. Each document is rendered with the default options, with no
+**  options, with each HoedownExt* and HoedownRender* directive flipped on
+**  its own and with all of them on. Throughput, p50/p99 latency and the
+**  number of heap allocations per render (when the linker supports
+**  --wrap) are reported. hoedown allocates from a pool cleared between
+**  renders, as it does from the request pool in the module; -H uses the
+**  heap instead.
+**
+**  -S compares the byte set scanning kernels (hoedown_scan.h) instead:
+**  the parser's active characters and the form decoder's stops are found
+**  through prose and through markup with each kernel the cpu has.
+**
+**  -C checks the split of documents into top level blocks (hoedown_chunks)
+**  instead: with each of the options above, a document is rendered whole
+**  and block by block, as the render threads and HoedownRenderBudget do.
+**  It exits with failure when the two differ.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* apr */
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_file_io.h"
+#include "apr_file_info.h"
+#include "apr_strings.h"
+
+#ifdef HAVE_CONFIG_H
+#  undef PACKAGE_NAME
+#  undef PACKAGE_STRING
+#  undef PACKAGE_TARNAME
+#  undef PACKAGE_VERSION
+#  include "config.h"
+#endif
+
+/* hoedown */
+#include "hoedown_render.h"
+#include "hoedown_alloc.h"
+#include "hoedown_scan.h"
+
+#define HOEDOWN_BENCH_BUDGET   2000000000LL  /* ns per document/options */
+#define HOEDOWN_BENCH_MIN      5
+#define HOEDOWN_BENCH_MAX      100000
+
+typedef struct {
+    char const *name;
+    apr_size_t size;
+} hoedown_bench_corpus_t;
+
+static const hoedown_bench_corpus_t hoedown_bench_corpus[] = {
+    { "small", 4 * 1024 },
+    { "medium", 256 * 1024 },
+    { "large", 4 * 1024 * 1024 },
+    { NULL, 0 }
+};
+
+/* one of each block and span the options touch */
+static const char hoedown_bench_text[] =
+    "## Section header\n"
+    "\n"
+    "Some *emphasis*, **strong**, ~~strike~~, _underline_, ==mark==,\n"
+    "\"quote\", super^script, `code span`, a [link](http://example.com/)\n"
+    "and an ![image](image.png), http://example.com/autolink and a\n"
+    "footnote[^1]. Tabs\tand <span>inline html</span> & entities.\n"
+    "\n"
+    "### Sub header {#id .class}\n"
+    "\n"
+    "* list item\n"
+    "* [ ] task item\n"
+    "    1. nested ordered item\n"
+    "    2. second\n"
+    "\n"
+    "> block quote with a line  \n"
+    "> hard break\n"
+    "\n"
+    "```c\n"
+    "int main(void) { return 0; }\n"
+    "```\n"
+    "\n"
+    "    indented code\n"
+    "\n"
+    "| left | center | right |\n"
+    "|:-----|:------:|------:|\n"
+    "| a    | b      | c     |\n"
+    "\n"
+    "<div class=\"raw\">raw html block</div>\n"
+    "\n"
+    "---\n"
+    "\n"
+    "[^1]: The footnote.\n"
+    "\n";
+
+/* running text, where the parser mostly copies inactive bytes */
+static const char hoedown_bench_prose[] =
+    "The module reads the markdown file of the request, renders it with\n"
+    "the options of its directory and writes the page through the style\n"
+    "template. Most of the documents it serves are plain prose, with a\n"
+    "heading now and then, a few links and some emphasis, so the parser\n"
+    "spends its time going through text that needs nothing done to it.\n"
+    "\n";
+
+typedef struct {
+    char const *name;
+    char const *chars;
+} hoedown_bench_set_t;
+
+static const hoedown_bench_set_t hoedown_bench_sets[] = {
+    /* the inline parser's active characters, default extensions */
+    { "active", "*_~`\n[!<\\&:@w" },
+    /* form_decode() */
+    { "form", "%+&=" },
+    { NULL, NULL }
+};
+
+/* allocation counter, when linked with --wrap */
+static apr_uint64_t hoedown_bench_allocs;
+
+#ifdef HOEDOWN_BENCH_WRAP
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    hoedown_bench_allocs++;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+    hoedown_bench_allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    hoedown_bench_allocs++;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+typedef struct {
+    apr_pool_t *pool;
+    hoedown_style_t *style;
+    hoedown_context_t *context;
+    int iterations;
+    int heap;
+    long long *samples;
+    int chunks;
+    int differences;
+} hoedown_bench_t;
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+compare_ns(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* the handler's steps, from opening the file to the complete page */
+static apr_status_t
+render_once(hoedown_bench_t *bench, hoedown_config_rec *cfg,
+            char const *filename, apr_pool_t *p)
+{
+    hoedown_buffer *ib, *page, *ob, *toc_ob = NULL;
+    apr_file_t *fp = NULL;
+    apr_finfo_t finfo;
+    apr_size_t read = 0;
+    apr_status_t rv;
+
+    /* input */
+    rv = apr_file_open(&fp, filename, APR_READ | APR_BINARY,
+                       APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    apr_file_info_get(&finfo, APR_FINFO_SIZE, fp);
+
+    ib = hoedown_buffer_new(HOEDOWN_PAGE_UNIT);
+    hoedown_buffer_grow(ib, (size_t)finfo.size);
+    apr_file_read_full(fp, ib->data, (apr_size_t)finfo.size, &read);
+    ib->size = read;
+    apr_file_close(fp);
+
+    /* page */
+    page = hoedown_buffer_new(HOEDOWN_PAGE_UNIT);
+    hoedown_style_header(page, bench->style,
+                         hoedown_page_title(p, filename));
+
+    ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    hoedown_buffer_grow(ob, ib->size + (ib->size >> 1));
+    if (cfg->html & HOEDOWN_HTML_TOC) {
+        toc_ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    }
+
+    hoedown_context_render(bench->context, ib->data, ib->size, toc_ob, ob);
+
+    if (toc_ob) {
+        hoedown_buffer_put(page, toc_ob->data, toc_ob->size);
+        hoedown_buffer_free(toc_ob);
+    }
+    hoedown_buffer_put(page, ob->data, ob->size);
+    hoedown_buffer_free(ob);
+
+    hoedown_style_footer(page, bench->style);
+
+    hoedown_buffer_free(page);
+    hoedown_buffer_free(ib);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * The page rendered whole against its blocks rendered one by one, each
+ * after the link references of the document and joined as the module
+ * does: every grouping of the blocks the module makes renders as this.
+ */
+static void
+chunk_run(hoedown_bench_t *bench, char const *corpus, char const *filename,
+          apr_off_t size, char const *name, hoedown_config_rec *cfg)
+{
+    apr_array_header_t *chunks = NULL;
+    hoedown_chunk_t *chunk, refs;
+    hoedown_buffer *whole, *joined, *part;
+    apr_file_t *fp = NULL;
+    apr_pool_t *p;
+    const uint8_t *source;
+    uint8_t *data;
+    apr_size_t read = 0, i;
+    size_t source_size;
+    char const *result;
+    int n;
+
+    apr_pool_create(&p, bench->pool);
+
+    if (apr_file_open(&fp, filename, APR_READ | APR_BINARY,
+                      APR_OS_DEFAULT, p) != APR_SUCCESS) {
+        fprintf(stderr, "hoedown-bench: cannot read %s\n", filename);
+        bench->differences++;
+        apr_pool_destroy(p);
+        return;
+    }
+    data = apr_palloc(p, (apr_size_t)size + 1);
+    apr_file_read_full(fp, data, (apr_size_t)size, &read);
+    apr_file_close(fp);
+
+    /* the module renders a page with a toc whole */
+    if (!(cfg->html & HOEDOWN_HTML_TOC)) {
+        chunks = hoedown_chunks(p, cfg, data, read, &refs);
+    }
+    if (chunks == NULL || chunks->nelts < 2) {
+        printf("%-8s %-32s %9" APR_OFF_T_FMT " %7d %s\n",
+               corpus, name, size, chunks ? chunks->nelts : 0, "whole");
+        apr_pool_destroy(p);
+        return;
+    }
+
+    whole = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    hoedown_render(cfg, cfg->toc.begin, cfg->toc.end, data, read, NULL,
+                   whole);
+
+    joined = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    part = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    chunk = (hoedown_chunk_t *)chunks->elts;
+    for (n = 0; n < chunks->nelts; n++) {
+        source = hoedown_chunk_source(p, data, &refs, chunk[n].data,
+                                      chunk[n].size, &source_size);
+
+        /* the renderer starts a block with a newline unless it is first */
+        hoedown_buffer_reset(part);
+        hoedown_buffer_putc(part, '\n');
+        hoedown_render(cfg, cfg->toc.begin, cfg->toc.end, source,
+                       source_size, NULL, part);
+        hoedown_chunk_join(joined, part);
+    }
+
+    if (whole->size == joined->size
+        && memcmp(whole->data, joined->data, whole->size) == 0) {
+        result = "ok";
+    } else {
+        for (i = 0; i < whole->size && i < joined->size
+                 && whole->data[i] == joined->data[i]; i++);
+        fprintf(stderr, "hoedown-bench: %s %s: blocks differ from the "
+                "whole render at byte %" APR_SIZE_T_FMT "\n",
+                filename, name, i);
+        bench->differences++;
+        result = "DIFFER";
+    }
+
+    printf("%-8s %-32s %9" APR_OFF_T_FMT " %7d %s\n",
+           corpus, name, size, chunks->nelts, result);
+
+    hoedown_buffer_free(part);
+    hoedown_buffer_free(joined);
+    hoedown_buffer_free(whole);
+    apr_pool_destroy(p);
+}
+
+static void
+run(hoedown_bench_t *bench, char const *corpus, char const *filename,
+    apr_off_t size, char const *name, hoedown_config_rec *cfg)
+{
+    apr_pool_t *p;
+    apr_uint64_t allocs;
+    long long start, total = 0;
+    int i, n = bench->iterations;
+
+    if (bench->chunks) {
+        chunk_run(bench, corpus, filename, size, name, cfg);
+        return;
+    }
+
+    apr_pool_create(&p, bench->pool);
+
+    /* made once and reused, as the module does per thread */
+    bench->context = hoedown_context_new(cfg, cfg->toc.begin, cfg->toc.end,
+                                         cfg->html & HOEDOWN_HTML_TOC);
+    if (bench->context == NULL) {
+        fprintf(stderr, "hoedown-bench: out of memory\n");
+        apr_pool_destroy(p);
+        return;
+    }
+
+    /* hoedown allocates from the request pool, as in the module */
+    if (!bench->heap) {
+        hoedown_arena_set(p);
+    }
+
+    /* warm up, and size the run to the time budget */
+    start = now_ns();
+    if (render_once(bench, cfg, filename, p) != APR_SUCCESS) {
+        fprintf(stderr, "hoedown-bench: cannot read %s\n", filename);
+        hoedown_arena_set(NULL);
+        hoedown_context_free(bench->context);
+        apr_pool_destroy(p);
+        return;
+    }
+    if (n <= 0) {
+        long long once = now_ns() - start;
+        n = once > 0
+            ? (int)(HOEDOWN_BENCH_BUDGET / once) : HOEDOWN_BENCH_MAX;
+        if (n < HOEDOWN_BENCH_MIN) {
+            n = HOEDOWN_BENCH_MIN;
+        } else if (n > HOEDOWN_BENCH_MAX) {
+            n = HOEDOWN_BENCH_MAX;
+        }
+    }
+
+    allocs = hoedown_bench_allocs;
+    for (i = 0; i < n; i++) {
+        apr_pool_clear(p);
+        start = now_ns();
+        render_once(bench, cfg, filename, p);
+        bench->samples[i] = now_ns() - start;
+        total += bench->samples[i];
+    }
+    allocs = hoedown_bench_allocs - allocs;
+
+    hoedown_arena_set(NULL);
+
+    qsort(bench->samples, n, sizeof(long long), compare_ns);
+
+    printf("%-8s %-32s %9" APR_OFF_T_FMT " %7d %9.2f %10.1f %10.1f",
+           corpus, name, size, n,
+           total > 0 ? ((double)size * n / (1024 * 1024))
+                       / ((double)total / 1e9) : 0.0,
+           bench->samples[n / 2] / 1e3,
+           bench->samples[(n * 99) / 100] / 1e3);
+#ifdef HOEDOWN_BENCH_WRAP
+    printf(" %9.1f\n", (double)allocs / n);
+#else
+    printf(" %9s\n", "-");
+#endif
+
+    hoedown_context_free(bench->context);
+    apr_pool_destroy(p);
+}
+
+/* default, none, each flag flipped on its own, and everything */
+static void
+run_options(hoedown_bench_t *bench, char const *corpus, char const *filename,
+            hoedown_config_rec *base)
+{
+    const hoedown_option_t *option;
+    hoedown_config_rec cfg;
+    apr_finfo_t finfo;
+
+    if (apr_stat(&finfo, filename, APR_FINFO_SIZE, bench->pool)
+        != APR_SUCCESS) {
+        fprintf(stderr, "hoedown-bench: cannot stat %s\n", filename);
+        return;
+    }
+
+    run(bench, corpus, filename, finfo.size, "default", base);
+
+    cfg = *base;
+    cfg.extensions = 0;
+    cfg.html = 0;
+    run(bench, corpus, filename, finfo.size, "none", &cfg);
+
+    for (option = hoedown_options; option->name; option++) {
+        cfg = *base;
+        if (option->type == HOEDOWN_OPTION_EXTENSION) {
+            cfg.extensions ^= option->value;
+        } else if (option->type == HOEDOWN_OPTION_RENDER) {
+            cfg.html ^= option->value;
+        } else {
+            continue;
+        }
+        run(bench, corpus, filename, finfo.size,
+            apr_psprintf(bench->pool, "%s %s", option->name,
+                         ((option->type == HOEDOWN_OPTION_EXTENSION
+                           ? cfg.extensions : cfg.html) & option->value)
+                         ? "On" : "Off"),
+            &cfg);
+    }
+
+    cfg = *base;
+    for (option = hoedown_options; option->name; option++) {
+        if (option->type == HOEDOWN_OPTION_EXTENSION) {
+            cfg.extensions |= option->value;
+        } else if (option->type == HOEDOWN_OPTION_RENDER) {
+            cfg.html |= option->value;
+        }
+    }
+    /* these two only drop output */
+    cfg.html &= ~(HOEDOWN_HTML_SKIP_HTML | HOEDOWN_HTML_ESCAPE);
+    run(bench, corpus, filename, finfo.size, "all", &cfg);
+}
+
+/* every hit of the set in data, with one kernel */
+static void
+scan_run(hoedown_bench_t *bench, char const *corpus, const uint8_t *data,
+         apr_size_t size, const hoedown_bench_set_t *set)
+{
+    hoedown_scan_t scan;
+    hoedown_scan_level_t level, cpu = hoedown_scan_cpu();
+    apr_uint64_t hits, sum, expected = 0;
+    apr_size_t i;
+    double scalar = 0.0, mbs;
+    long long start, total;
+    int n, k;
+
+    for (level = HOEDOWN_SCAN_SCALAR; level <= cpu; level++) {
+        hoedown_scan_init(&scan, (const uint8_t *)set->chars,
+                          strlen(set->chars), level);
+        if (scan.level != level) {
+            continue;
+        }
+
+        n = bench->iterations;
+        total = 0;
+        for (k = 0; n > 0 ? k < n : (total < HOEDOWN_BENCH_BUDGET / 4
+                                     && k < HOEDOWN_BENCH_MAX); k++) {
+            start = now_ns();
+            hits = sum = 0;
+            for (i = 0; i < size; i++) {
+                i += hoedown_scan_find(&scan, data + i, size - i);
+                if (i < size) {
+                    hits++;
+                    sum += i;
+                }
+            }
+            total += now_ns() - start;
+        }
+
+        /* all the kernels stop at the same bytes */
+        if (level == HOEDOWN_SCAN_SCALAR) {
+            expected = sum;
+        } else if (sum != expected) {
+            fprintf(stderr, "hoedown-bench: %s kernel mismatch on %s\n",
+                    hoedown_scan_level_name(level), set->name);
+        }
+
+        mbs = total > 0 ? ((double)size * k / (1024 * 1024))
+            / ((double)total / 1e9) : 0.0;
+        if (level == HOEDOWN_SCAN_SCALAR) {
+            scalar = mbs;
+        }
+
+        printf("%-8s %-8s %-8s %9" APR_SIZE_T_FMT " %9" APR_UINT64_T_FMT
+               " %7d %9.1f %7.2fx\n",
+               corpus, set->name, hoedown_scan_level_name(level), size,
+               hits, k, mbs, scalar > 0 ? mbs / scalar : 0.0);
+    }
+}
+
+static void
+scan_options(hoedown_bench_t *bench, char const *corpus, const uint8_t *data,
+             apr_size_t size)
+{
+    const hoedown_bench_set_t *set;
+
+    for (set = hoedown_bench_sets; set->name; set++) {
+        scan_run(bench, corpus, data, size, set);
+    }
+}
+
+/* text repeated to size */
+static uint8_t *
+corpus_make(apr_pool_t *p, char const *text, apr_size_t len, apr_size_t size)
+{
+    uint8_t *data = apr_palloc(p, size);
+    apr_size_t i;
+
+    for (i = 0; i < size; i += len) {
+        memcpy(data + i, text, size - i < len ? size - i : len);
+    }
+
+    return data;
+}
+
+static int
+scan_main(hoedown_bench_t *bench, int argc, char const * const *argv,
+          int ind)
+{
+    int i;
+
+    printf("%-8s %-8s %-8s %9s %9s %7s %9s %8s\n",
+           "corpus", "set", "kernel", "bytes", "hits", "scans", "MB/s",
+           "speedup");
+
+    if (ind < argc) {
+        for (i = ind; i < argc; i++) {
+            apr_file_t *fp = NULL;
+            apr_finfo_t finfo;
+            apr_size_t read = 0;
+            uint8_t *data;
+
+            if (apr_file_open(&fp, argv[i], APR_READ | APR_BINARY,
+                              APR_OS_DEFAULT, bench->pool) != APR_SUCCESS
+                || apr_file_info_get(&finfo, APR_FINFO_SIZE, fp)
+                != APR_SUCCESS) {
+                fprintf(stderr, "hoedown-bench: cannot read %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            data = apr_palloc(bench->pool, (apr_size_t)finfo.size + 1);
+            apr_file_read_full(fp, data, (apr_size_t)finfo.size, &read);
+            apr_file_close(fp);
+
+            scan_options(bench, "file", data, read);
+        }
+    } else {
+        const hoedown_bench_corpus_t *corpus;
+
+        for (corpus = hoedown_bench_corpus; corpus->name; corpus++) {
+            scan_options(bench,
+                         apr_pstrcat(bench->pool, corpus->name, "-p", NULL),
+                         corpus_make(bench->pool, hoedown_bench_prose,
+                                     sizeof(hoedown_bench_prose) - 1,
+                                     corpus->size),
+                         corpus->size);
+            scan_options(bench,
+                         apr_pstrcat(bench->pool, corpus->name, "-m", NULL),
+                         corpus_make(bench->pool, hoedown_bench_text,
+                                     sizeof(hoedown_bench_text) - 1,
+                                     corpus->size),
+                         corpus->size);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static char *
+corpus_write(apr_pool_t *p, char const *tmpdir, char const *name,
+             apr_size_t size)
+{
+    apr_file_t *fp = NULL;
+    char *path = apr_psprintf(p, "%s/hoedown-bench-%s-XXXXXX", tmpdir, name);
+    apr_size_t written = 0;
+
+    if (apr_file_mktemp(&fp, path, APR_FOPEN_CREATE | APR_FOPEN_WRITE |
+                        APR_FOPEN_EXCL | APR_FOPEN_BINARY, p)
+        != APR_SUCCESS) {
+        return NULL;
+    }
+
+    while (written < size) {
+        apr_file_write_full(fp, hoedown_bench_text,
+                            sizeof(hoedown_bench_text) - 1, NULL);
+        written += sizeof(hoedown_bench_text) - 1;
+    }
+
+    apr_file_close(fp);
+
+    return path;
+}
+
+int
+main(int argc, char const * const *argv)
+{
+    static const apr_getopt_option_t opts[] = {
+        { "iterations", 'n', 1, "renders per document and options" },
+        { "style", 's', 1, "style template file" },
+        { "heap", 'H', 0, "allocate from the heap instead of a pool" },
+        { "scan", 'S', 0, "compare the byte scanning kernels" },
+        { "chunks", 'C', 0, "check block by block renders" },
+        { "help", 'h', 0, "show help" },
+        { NULL, 0, 0, NULL }
+    };
+    hoedown_bench_t bench;
+    hoedown_config_rec cfg;
+    apr_getopt_t *opt;
+    char const *arg, *style = NULL, *tmpdir;
+    int ch, i, scan = 0;
+    apr_status_t rv;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    atexit(apr_terminate);
+
+    memset(&bench, 0, sizeof(bench));
+    apr_pool_create(&bench.pool, NULL);
+
+    apr_getopt_init(&opt, bench.pool, argc, argv);
+    while ((rv = apr_getopt_long(opt, opts, &ch, &arg)) == APR_SUCCESS) {
+        switch (ch) {
+            case 'n':
+                bench.iterations = atoi(arg);
+                break;
+            case 's':
+                style = arg;
+                break;
+            case 'H':
+                bench.heap = 1;
+                break;
+            case 'S':
+                scan = 1;
+                break;
+            case 'C':
+                bench.chunks = 1;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-n ITERATIONS] [-s STYLE] [-H] "
+                        "[FILE...]\n"
+                        "       %s -S [-n ITERATIONS] [FILE...]\n"
+                        "       %s -C [FILE...]\n",
+                        argv[0], argv[0], argv[0]);
+                return ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (rv != APR_EOF) {
+        return EXIT_FAILURE;
+    }
+
+    bench.samples = apr_palloc(bench.pool, sizeof(long long)
+                               * (bench.iterations > 0
+                                  ? bench.iterations : HOEDOWN_BENCH_MAX));
+
+    if (scan) {
+        ch = scan_main(&bench, argc, argv, opt->ind);
+        apr_pool_destroy(bench.pool);
+        return ch;
+    }
+
+    /* module defaults */
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.style.ext = HOEDOWN_STYLE_EXT;
+    cfg.toc.begin = HOEDOWN_TOC_BEGIN;
+    cfg.toc.end = HOEDOWN_TOC_END;
+    cfg.max_nesting = HOEDOWN_MAX_NESTING;
+    cfg.extensions = HOEDOWN_EXTENSIONS_DEFAULT;
+
+    if (style) {
+        apr_finfo_t finfo;
+
+        if (apr_stat(&finfo, style, APR_FINFO_MTIME | APR_FINFO_SIZE,
+                     bench.pool) != APR_SUCCESS
+            || (bench.style = hoedown_style_parse(bench.pool, style,
+                                                  &finfo)) == NULL) {
+            fprintf(stderr, "hoedown-bench: cannot read style %s\n", style);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (bench.chunks) {
+        printf("%-8s %-32s %9s %7s %s\n",
+               "corpus", "options", "bytes", "blocks", "result");
+    } else {
+        printf("%-8s %-32s %9s %7s %9s %10s %10s %9s\n",
+               "corpus", "options", "bytes", "renders", "MB/s",
+               "p50(us)", "p99(us)", "allocs");
+    }
+
+    if (opt->ind < argc) {
+        for (i = opt->ind; i < argc; i++) {
+            run_options(&bench, "file", argv[i], &cfg);
+        }
+    } else {
+        const hoedown_bench_corpus_t *corpus;
+
+        if (apr_temp_dir_get(&tmpdir, bench.pool) != APR_SUCCESS) {
+            tmpdir = ".";
+        }
+
+        for (corpus = hoedown_bench_corpus; corpus->name; corpus++) {
+            char *path = corpus_write(bench.pool, tmpdir, corpus->name,
+                                      corpus->size);
+            if (path == NULL) {
+                fprintf(stderr, "hoedown-bench: cannot write to %s\n",
+                        tmpdir);
+                return EXIT_FAILURE;
+            }
+            run_options(&bench, corpus->name, path, &cfg);
+            apr_file_remove(path, bench.pool);
+        }
+    }
+
+    apr_pool_destroy(bench.pool);
+
+    return bench.differences ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+/*
+**  hoedown_escape.c -- vectorized escaping for the hoedown sources
+**
+**  Linked with ld --wrap=hoedown_escape_html --wrap=hoedown_escape_href
+**  (HOEDOWN_ESCAPE_WRAP): the renderer's calls come here. The runs of
+**  bytes that need no escaping are found with hoedown_scan and copied
+**  as they are; the bytes between them go to the escape.c functions, so
+**  the output is theirs byte for byte. The sets hold every byte escape.c
+**  may change, and a few it keeps: those come out of it unchanged.
+*/
+
+#include <string.h>
+
+#include "hoedown_scan.h"
+
+/* hoedown */
+#include "hoedown/src/buffer.h"
+#include "hoedown/src/escape.h"
+
+#ifdef HOEDOWN_ESCAPE_WRAP
+
+void __real_hoedown_escape_html(hoedown_buffer *ob, const uint8_t *data,
+                                size_t size, int secure);
+void __real_hoedown_escape_href(hoedown_buffer *ob, const uint8_t *data,
+                                size_t size);
+
+/* '/' is only escaped when secure */
+static const uint8_t escape_html_chars[] = "\"&'/<>";
+
+/* what a url keeps as it is, everything else may be escaped */
+static const uint8_t escape_href_safe[] = "-._~/:?#=";
+
+static hoedown_scan_t escape_html_scan;
+static hoedown_scan_t escape_href_scan;
+
+/* before any render: the module is loaded or the tool started */
+__attribute__((constructor))
+static void
+escape_init(void)
+{
+    uint8_t chars[256];
+    size_t n = 0;
+    int c;
+
+    hoedown_scan_init(&escape_html_scan, escape_html_chars,
+                      sizeof(escape_html_chars) - 1, HOEDOWN_SCAN_AVX2);
+
+    for (c = 0; c < 256; c++) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+              || (c >= 'A' && c <= 'Z')
+              || (c && memchr(escape_href_safe, c,
+                              sizeof(escape_href_safe) - 1)))) {
+            chars[n++] = (uint8_t)c;
+        }
+    }
+    hoedown_scan_init(&escape_href_scan, chars, n, HOEDOWN_SCAN_AVX2);
+}
+
+void
+__wrap_hoedown_escape_html(hoedown_buffer *ob, const uint8_t *data,
+                           size_t size, int secure)
+{
+    size_t i = 0, mark;
+
+    while (i < size) {
+        mark = i;
+        i += hoedown_scan_find(&escape_html_scan, data + i, size - i);
+        if (i > mark) {
+            hoedown_buffer_put(ob, data + mark, i - mark);
+        }
+        if (i >= size) {
+            break;
+        }
+
+        mark = i++;
+        while (i < size && escape_html_scan.table[data[i]]) {
+            i++;
+        }
+        __real_hoedown_escape_html(ob, data + mark, i - mark, secure);
+    }
+}
+
+void
+__wrap_hoedown_escape_href(hoedown_buffer *ob, const uint8_t *data,
+                           size_t size)
+{
+    size_t i = 0, mark;
+
+    while (i < size) {
+        mark = i;
+        i += hoedown_scan_find(&escape_href_scan, data + i, size - i);
+        if (i > mark) {
+            hoedown_buffer_put(ob, data + mark, i - mark);
+        }
+        if (i >= size) {
+            break;
+        }
+
+        mark = i++;
+        while (i < size && escape_href_scan.table[data[i]]) {
+            i++;
+        }
+        __real_hoedown_escape_href(ob, data + mark, i - mark);
+    }
+}
+
+#endif
@@ -0,0 +1,509 @@
+/*
+**  hoedown_prerender.c -- write pre-rendered pages for mod_hoedown
+**
+**    % hoedown-prerender [-c httpd.conf] [-o 'Directive value'] [-z] \
+**                        /var/www/html
+**
+**  Every markdown file under the document root gets a sidecar page
+**  (README.md -> README.md.html, README.md.html.gz with -z) rendered with
+**  the same style template and options as the module. The first line of
+**  a sidecar is the page fingerprint: source and style mtime/size, the
+**  title and the render options. With "HoedownPrerendered On" the module
+**  serves the sidecar while its fingerprint matches, and renders the page
+**  otherwise.
+**
+**  Options are the module's Hoedown* directives, read from the given
+**  configuration files (other lines are ignored) or passed with -o.
+**  The document root must be given as the same path as DocumentRoot.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* apr */
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_file_io.h"
+#include "apr_file_info.h"
+#include "apr_strings.h"
+#include "apr_lib.h"
+
+#ifdef HAVE_CONFIG_H
+#  undef PACKAGE_NAME
+#  undef PACKAGE_STRING
+#  undef PACKAGE_TARNAME
+#  undef PACKAGE_VERSION
+#  include "config.h"
+#endif
+
+/* hoedown */
+#include "hoedown_render.h"
+
+#define HOEDOWN_PRERENDER_EXT  ".md"
+#define HOEDOWN_PRERENDER_PERM \
+    (APR_FPROT_UREAD | APR_FPROT_UWRITE | APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+typedef struct {
+    apr_pool_t *pool;
+    hoedown_config_rec cfg;
+    char const *root;
+    char const *ext;
+    char const *style_path;
+    apr_finfo_t style_finfo;
+    hoedown_style_t *style;
+    hoedown_context_t *context;
+    int gzip;
+    int force;
+    int verbose;
+    int errors;
+} hoedown_prerender_t;
+
+static void
+usage(char const *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-c FILE] [-o 'DIRECTIVE VALUE'] [-x EXT] [-z] [-f] "
+            "[-v] DOCUMENT_ROOT...\n"
+            "  -c FILE  read Hoedown* directives from FILE\n"
+            "  -o LINE  set a Hoedown* directive\n"
+            "  -x EXT   markdown file extension (default: %s)\n"
+            "  -z       also write gzip sidecars\n"
+            "  -f       rewrite sidecars that are up to date\n"
+            "  -v       verbose\n",
+            name, HOEDOWN_PRERENDER_EXT);
+}
+
+/* one "Directive value" line, as the module would apply it */
+static int
+option_set(hoedown_prerender_t *ctx, char const *line)
+{
+    const hoedown_option_t *option;
+    char *name, *value, *last, *end;
+    int on;
+
+    name = apr_strtok(apr_pstrdup(ctx->pool, line), " \t\r\n", &last);
+    if (name == NULL || *name == '#') {
+        return 0;
+    }
+
+    for (option = hoedown_options; option->name; option++) {
+        if (strcasecmp(option->name, name) == 0) {
+            break;
+        }
+    }
+    if (option->name == NULL) {
+        return 0;
+    }
+
+    while (apr_isspace(*last)) {
+        last++;
+    }
+    value = last;
+    end = value + strlen(value);
+    while (end > value && apr_isspace(end[-1])) {
+        *--end = '\0';
+    }
+    if (end - value >= 2 && (*value == '"' || *value == '\'')
+        && end[-1] == *value) {
+        *--end = '\0';
+        value++;
+    }
+
+    on = strcasecmp(value, "On") == 0;
+
+    switch (option->type) {
+        case HOEDOWN_OPTION_EXTENSION:
+            if (on) {
+                ctx->cfg.extensions |= option->value;
+            } else {
+                ctx->cfg.extensions ^= option->value;
+            }
+            break;
+        case HOEDOWN_OPTION_RENDER:
+            if (on) {
+                ctx->cfg.html |= option->value;
+            } else {
+                ctx->cfg.html ^= option->value;
+            }
+            break;
+        case HOEDOWN_OPTION_STRING:
+            *(char **)((char *)&ctx->cfg + option->value) = value;
+            break;
+        case HOEDOWN_OPTION_INT:
+            *(int *)((char *)&ctx->cfg + option->value) = atoi(value);
+            break;
+        case HOEDOWN_OPTION_FLAG:
+            *(int *)((char *)&ctx->cfg + option->value) = on;
+            break;
+    }
+
+    return 1;
+}
+
+static apr_status_t
+option_file(hoedown_prerender_t *ctx, char const *filename)
+{
+    apr_file_t *fp = NULL;
+    char line[HOEDOWN_LINE_MAX];
+    apr_status_t rv;
+
+    rv = apr_file_open(&fp, filename, APR_READ, APR_OS_DEFAULT, ctx->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    while (apr_file_gets(line, sizeof(line), fp) == APR_SUCCESS) {
+        option_set(ctx, line);
+    }
+
+    apr_file_close(fp);
+
+    return APR_SUCCESS;
+}
+
+/* the default style, as the module resolves it without ?style= */
+static void
+style_load(hoedown_prerender_t *ctx)
+{
+    char const *path = ctx->cfg.style.path;
+
+    if (ctx->cfg.style.name == NULL) {
+        return;
+    }
+    if (path == NULL) {
+        path = ctx->root;
+    }
+
+    ctx->style_path = apr_psprintf(ctx->pool, "%s/%s%s", path,
+                                   ctx->cfg.style.name, ctx->cfg.style.ext);
+    if (apr_stat(&ctx->style_finfo, ctx->style_path,
+                 APR_FINFO_MTIME | APR_FINFO_SIZE | APR_FINFO_TYPE,
+                 ctx->pool) != APR_SUCCESS
+        || ctx->style_finfo.filetype != APR_REG) {
+        ctx->style_path = NULL;
+        return;
+    }
+
+    ctx->style = hoedown_style_parse(ctx->pool, ctx->style_path,
+                                     &ctx->style_finfo);
+}
+
+static int
+sidecar_fresh(apr_pool_t *p, char const *path, char const *header)
+{
+    apr_file_t *fp = NULL;
+    apr_size_t len = strlen(header), read = 0;
+    char *buf;
+    int fresh = 0;
+
+    if (apr_file_open(&fp, path, APR_READ | APR_BINARY, APR_OS_DEFAULT,
+                      p) != APR_SUCCESS) {
+        return 0;
+    }
+
+    buf = apr_palloc(p, len);
+    if (apr_file_read_full(fp, buf, len, &read) == APR_SUCCESS
+        && memcmp(buf, header, len) == 0) {
+        fresh = 1;
+    }
+
+    apr_file_close(fp);
+
+    return fresh;
+}
+
+/* written to a temporary file and renamed over the old sidecar */
+static apr_status_t
+sidecar_write(apr_pool_t *p, char const *path, char const *header,
+              const void *data, apr_size_t size)
+{
+    apr_file_t *fp = NULL;
+    char *tmp = apr_pstrcat(p, path, ".XXXXXX", NULL);
+    apr_status_t rv;
+
+    rv = apr_file_mktemp(&fp, tmp, APR_FOPEN_CREATE | APR_FOPEN_WRITE |
+                         APR_FOPEN_EXCL | APR_FOPEN_BINARY, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = apr_file_write_full(fp, header, strlen(header), NULL);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(fp, data, size, NULL);
+    }
+    if (apr_file_close(fp) != APR_SUCCESS && rv == APR_SUCCESS) {
+        rv = APR_EGENERAL;
+    }
+    if (rv == APR_SUCCESS) {
+        apr_file_perms_set(tmp, HOEDOWN_PRERENDER_PERM);
+        rv = apr_file_rename(tmp, path, p);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_remove(tmp, p);
+    }
+
+    return rv;
+}
+
+static apr_status_t
+prerender(hoedown_prerender_t *ctx, apr_pool_t *p, char const *filename,
+          apr_finfo_t *finfo)
+{
+    char *fingerprint, *header, *sidecar;
+    apr_file_t *fp = NULL;
+    apr_size_t read = 0;
+    uint8_t *data;
+    hoedown_buffer *page, *ob, *toc_ob = NULL;
+    apr_status_t rv;
+
+    fingerprint = hoedown_page_fingerprint(p, &ctx->cfg, filename, finfo,
+                                           ctx->style_path,
+                                           &ctx->style_finfo,
+                                           hoedown_page_title(p, filename),
+                                           NULL);
+    header = hoedown_sidecar_header(p, fingerprint);
+    sidecar = apr_pstrcat(p, filename, HOEDOWN_SIDECAR_EXT, NULL);
+
+    if (!ctx->force && sidecar_fresh(p, sidecar, header)
+        && (!ctx->gzip
+            || sidecar_fresh(p, apr_pstrcat(p, filename,
+                                            HOEDOWN_SIDECAR_GZIP_EXT, NULL),
+                             header))) {
+        return APR_SUCCESS;
+    }
+
+    rv = apr_file_open(&fp, filename, APR_READ | APR_BINARY,
+                       APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    data = apr_palloc(p, (apr_size_t)finfo->size + 1);
+    rv = apr_file_read_full(fp, data, (apr_size_t)finfo->size, &read);
+    apr_file_close(fp);
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_EOF(rv)) {
+        return rv;
+    }
+
+    /* the page as the module renders it */
+    page = hoedown_buffer_new(HOEDOWN_PAGE_UNIT);
+    hoedown_style_header(page, ctx->style,
+                         hoedown_page_title(p, filename));
+
+    if (read > 0) {
+        ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+        hoedown_buffer_grow(ob, read + (read >> 1));
+        if (ctx->cfg.html & HOEDOWN_HTML_TOC) {
+            toc_ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+        }
+
+        hoedown_context_render(ctx->context, data, read, toc_ob, ob);
+
+        if (toc_ob) {
+            hoedown_buffer_put(page, toc_ob->data, toc_ob->size);
+            hoedown_buffer_free(toc_ob);
+        }
+        hoedown_buffer_put(page, ob->data, ob->size);
+        hoedown_buffer_free(ob);
+    }
+
+    hoedown_style_footer(page, ctx->style);
+
+    rv = sidecar_write(p, sidecar, header, page->data, page->size);
+
+#ifdef HAVE_ZLIB
+    if (rv == APR_SUCCESS && ctx->gzip) {
+        unsigned char *out;
+        apr_size_t outlen;
+
+        rv = hoedown_compress_gzip(p, page->data, page->size, &out, &outlen);
+        if (rv == APR_SUCCESS) {
+            rv = sidecar_write(p,
+                               apr_pstrcat(p, filename,
+                                           HOEDOWN_SIDECAR_GZIP_EXT, NULL),
+                               header, out, outlen);
+        }
+    }
+#endif
+
+    hoedown_buffer_free(page);
+
+    if (rv == APR_SUCCESS && ctx->verbose) {
+        printf("%s\n", sidecar);
+    }
+
+    return rv;
+}
+
+static void
+walk(hoedown_prerender_t *ctx, char const *dirname)
+{
+    apr_pool_t *p, *sub;
+    apr_dir_t *dir;
+    apr_finfo_t finfo;
+    apr_size_t ext_len = strlen(ctx->ext);
+    apr_status_t rv;
+
+    apr_pool_create(&p, ctx->pool);
+
+    rv = apr_dir_open(&dir, dirname, p);
+    if (rv != APR_SUCCESS) {
+        char buf[256];
+        fprintf(stderr, "hoedown-prerender: %s: %s\n", dirname,
+                apr_strerror(rv, buf, sizeof(buf)));
+        ctx->errors++;
+        apr_pool_destroy(p);
+        return;
+    }
+
+    apr_pool_create(&sub, p);
+
+    while ((rv = apr_dir_read(&finfo, APR_FINFO_NAME, dir)) == APR_SUCCESS
+           || rv == APR_INCOMPLETE) {
+        char const *name = finfo.name;
+        char *path;
+        apr_size_t len;
+
+        /* dot files, and . and .. */
+        if (name == NULL || name[0] == '.') {
+            continue;
+        }
+
+        path = apr_pstrcat(sub, dirname, "/", name, NULL);
+
+        /* stat'ed like the module does, following symlinks */
+        if (apr_stat(&finfo, path, APR_FINFO_TYPE | APR_FINFO_MTIME |
+                     APR_FINFO_SIZE, sub) != APR_SUCCESS) {
+            apr_pool_clear(sub);
+            continue;
+        }
+
+        if (finfo.filetype == APR_DIR) {
+            walk(ctx, path);
+        } else if (finfo.filetype == APR_REG) {
+            len = strlen(path);
+            if (len > ext_len
+                && strcmp(path + len - ext_len, ctx->ext) == 0) {
+                rv = prerender(ctx, sub, path, &finfo);
+                if (rv != APR_SUCCESS) {
+                    char buf[256];
+                    fprintf(stderr, "hoedown-prerender: %s: %s\n", path,
+                            apr_strerror(rv, buf, sizeof(buf)));
+                    ctx->errors++;
+                }
+            }
+        }
+
+        apr_pool_clear(sub);
+    }
+
+    apr_dir_close(dir);
+    apr_pool_destroy(p);
+}
+
+int
+main(int argc, char const * const *argv)
+{
+    static const apr_getopt_option_t opts[] = {
+        { "config", 'c', 1, "read Hoedown* directives from a file" },
+        { "option", 'o', 1, "set a Hoedown* directive" },
+        { "extension", 'x', 1, "markdown file extension" },
+        { "gzip", 'z', 0, "also write gzip sidecars" },
+        { "force", 'f', 0, "rewrite up to date sidecars" },
+        { "verbose", 'v', 0, "verbose" },
+        { "help", 'h', 0, "show help" },
+        { NULL, 0, 0, NULL }
+    };
+    hoedown_prerender_t ctx;
+    apr_getopt_t *opt;
+    char const *arg;
+    int ch;
+    apr_status_t rv;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    atexit(apr_terminate);
+
+    memset(&ctx, 0, sizeof(ctx));
+    apr_pool_create(&ctx.pool, NULL);
+
+    /* module defaults */
+    ctx.cfg.style.ext = HOEDOWN_STYLE_EXT;
+    ctx.cfg.toc.begin = HOEDOWN_TOC_BEGIN;
+    ctx.cfg.toc.end = HOEDOWN_TOC_END;
+    ctx.cfg.max_nesting = HOEDOWN_MAX_NESTING;
+    ctx.cfg.extensions = HOEDOWN_EXTENSIONS_DEFAULT;
+    ctx.ext = HOEDOWN_PRERENDER_EXT;
+
+    apr_getopt_init(&opt, ctx.pool, argc, argv);
+    while ((rv = apr_getopt_long(opt, opts, &ch, &arg)) == APR_SUCCESS) {
+        switch (ch) {
+            case 'c':
+                if (option_file(&ctx, arg) != APR_SUCCESS) {
+                    fprintf(stderr, "hoedown-prerender: cannot read %s\n",
+                            arg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                if (!option_set(&ctx, arg)) {
+                    fprintf(stderr, "hoedown-prerender: unknown option: %s\n",
+                            arg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'x':
+                ctx.ext = arg;
+                break;
+            case 'z':
+#ifndef HAVE_ZLIB
+                fprintf(stderr, "hoedown-prerender: built without zlib\n");
+                return EXIT_FAILURE;
+#endif
+                ctx.gzip = 1;
+                break;
+            case 'f':
+                ctx.force = 1;
+                break;
+            case 'v':
+                ctx.verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (rv != APR_EOF || opt->ind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* one document and renderer set for every page */
+    ctx.context = hoedown_context_new(&ctx.cfg, ctx.cfg.toc.begin,
+                                      ctx.cfg.toc.end,
+                                      ctx.cfg.html & HOEDOWN_HTML_TOC);
+    if (ctx.context == NULL) {
+        fprintf(stderr, "hoedown-prerender: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (; opt->ind < argc; opt->ind++) {
+        char *root = apr_pstrdup(ctx.pool, opt->argv[opt->ind]);
+        apr_size_t len = strlen(root);
+
+        while (len > 1 && root[len - 1] == '/') {
+            root[--len] = '\0';
+        }
+
+        ctx.root = root;
+        ctx.style = NULL;
+        ctx.style_path = NULL;
+        memset(&ctx.style_finfo, 0, sizeof(ctx.style_finfo));
+
+        style_load(&ctx);
+        walk(&ctx, root);
+    }
+
+    hoedown_context_free(ctx.context);
+    apr_pool_destroy(ctx.pool);
+
+    return ctx.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1201 @@
+/*
+**  hoedown_render.c -- rendering shared by mod_hoedown and hoedown-prerender
+**
+**  Only apr and hoedown are used here, no httpd.
+*/
+
+#include "apr_general.h"
+#include "apr_fnmatch.h"
+#include "apr_strings.h"
+#include "apr_lib.h"
+#include "apr_md5.h"
+#include "apr_file_io.h"
+
+#ifdef HAVE_CONFIG_H
+#  undef PACKAGE_NAME
+#  undef PACKAGE_STRING
+#  undef PACKAGE_TARNAME
+#  undef PACKAGE_VERSION
+#  include "config.h"
+#endif
+
+#ifdef HAVE_ZLIB
+/* zlib */
+#include "zlib.h"
+#endif
+
+#ifdef HAVE_BROTLI
+/* brotli */
+#include "brotli/encode.h"
+#endif
+
+#include "hoedown_render.h"
+#include "hoedown_alloc.h"
+
+#define HOEDOWN_OFFSET(_member) APR_OFFSETOF(hoedown_config_rec, _member)
+
+/* the directives that change the rendered page, for the tools */
+const hoedown_option_t hoedown_options[] = {
+    { "HoedownStylePath", HOEDOWN_OPTION_STRING,
+      HOEDOWN_OFFSET(style.path) },
+    { "HoedownStyleDefault", HOEDOWN_OPTION_STRING,
+      HOEDOWN_OFFSET(style.name) },
+    { "HoedownStyleExtension", HOEDOWN_OPTION_STRING,
+      HOEDOWN_OFFSET(style.ext) },
+#ifdef HOEDOWN_VERSION_EXTRAS
+    { "HoedownClassUl", HOEDOWN_OPTION_STRING, HOEDOWN_OFFSET(class.ul) },
+    { "HoedownClassOl", HOEDOWN_OPTION_STRING, HOEDOWN_OFFSET(class.ol) },
+    { "HoedownClassTask", HOEDOWN_OPTION_STRING,
+      HOEDOWN_OFFSET(class.task) },
+#endif
+    { "HoedownTocBegin", HOEDOWN_OPTION_INT, HOEDOWN_OFFSET(toc.begin) },
+    { "HoedownTocEnd", HOEDOWN_OPTION_INT, HOEDOWN_OFFSET(toc.end) },
+    { "HoedownMaxNesting", HOEDOWN_OPTION_INT, HOEDOWN_OFFSET(max_nesting) },
+#ifdef HOEDOWN_VERSION_EXTRAS
+    { "HoedownTocHeader", HOEDOWN_OPTION_STRING,
+      HOEDOWN_OFFSET(toc.header) },
+    { "HoedownTocFooter", HOEDOWN_OPTION_STRING,
+      HOEDOWN_OFFSET(toc.footer) },
+    { "HoedownTocUnescape", HOEDOWN_OPTION_FLAG,
+      HOEDOWN_OFFSET(toc.unescape) },
+#endif
+    { "HoedownExtSpaceHeaders", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_SPACE_HEADERS },
+    { "HoedownExtTables", HOEDOWN_OPTION_EXTENSION, HOEDOWN_EXT_TABLES },
+    { "HoedownExtFencedCode", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_FENCED_CODE },
+    { "HoedownExtFootnotes", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_FOOTNOTES },
+    { "HoedownExtAutolink", HOEDOWN_OPTION_EXTENSION, HOEDOWN_EXT_AUTOLINK },
+    { "HoedownExtStrikethrough", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_STRIKETHROUGH },
+    { "HoedownExtUnderline", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_UNDERLINE },
+    { "HoedownExtHighlight", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_HIGHLIGHT },
+    { "HoedownExtQuote", HOEDOWN_OPTION_EXTENSION, HOEDOWN_EXT_QUOTE },
+    { "HoedownExtSuperscript", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_SUPERSCRIPT },
+    { "HoedownExtLaxSpacing", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_LAX_SPACING },
+    { "HoedownExtNoIntraEmphasis", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_NO_INTRA_EMPHASIS },
+    { "HoedownExtDisableIndentedCode", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_DISABLE_INDENTED_CODE },
+#ifdef HOEDOWN_VERSION_EXTRAS
+    { "HoedownExtSpecialAttribute", HOEDOWN_OPTION_EXTENSION,
+      HOEDOWN_EXT_SPECIAL_ATTRIBUTE },
+#endif
+    { "HoedownRenderSkipHtml", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_SKIP_HTML },
+    { "HoedownRenderSkipStyle", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_SKIP_STYLE },
+    { "HoedownRenderSkipImages", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_SKIP_IMAGES },
+    { "HoedownRenderSkipLinks", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_SKIP_LINKS },
+    { "HoedownRenderExpandTabs", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_EXPAND_TABS },
+    { "HoedownRenderSafelink", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_SAFELINK },
+    { "HoedownRenderToc", HOEDOWN_OPTION_RENDER, HOEDOWN_HTML_TOC },
+    { "HoedownRenderHardWrap", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_HARD_WRAP },
+    { "HoedownRenderUseXhtml", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_USE_XHTML },
+    { "HoedownRenderEscape", HOEDOWN_OPTION_RENDER, HOEDOWN_HTML_ESCAPE },
+#ifdef HOEDOWN_VERSION_EXTRAS
+    { "HoedownRenderUseTaskList", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_USE_TASK_LIST },
+    { "HoedownRenderLineContinue", HOEDOWN_OPTION_RENDER,
+      HOEDOWN_HTML_LINE_CONTINUE },
+#endif
+    { NULL, 0, 0 }
+};
+
+hoedown_style_t *
+hoedown_style_parse(apr_pool_t *p, char const *filepath, apr_finfo_t *finfo)
+{
+    hoedown_style_t *style;
+    apr_file_t *fp = NULL;
+    apr_size_t read = 0, len;
+    hoedown_style_segment_t *segment;
+    char *data, *line, *end;
+
+    if (apr_file_open(&fp, filepath, APR_READ | APR_BINARY | APR_XTHREAD,
+                      APR_OS_DEFAULT, p) != APR_SUCCESS) {
+        return NULL;
+    }
+
+    data = apr_palloc(p, (apr_size_t)finfo->size + 1);
+    apr_file_read_full(fp, data, (apr_size_t)finfo->size, &read);
+    apr_file_close(fp);
+    data[read] = '\0';
+    end = data + read;
+
+    style = apr_pcalloc(p, sizeof(hoedown_style_t));
+    style->filepath = apr_pstrdup(p, filepath);
+    style->mtime = finfo->mtime;
+    style->size = finfo->size;
+    style->header = apr_array_make(p, 2, sizeof(hoedown_style_segment_t));
+
+    segment = apr_array_push(style->header);
+    segment->data = data;
+    segment->len = 0;
+
+    /* lines as apr_file_gets() returns them */
+    for (line = data; line < end; line += len) {
+        char *eol, *title, *buf;
+
+        eol = memchr(line, '\n', end - line);
+        len = eol ? (apr_size_t)(eol - line) + 1 : (apr_size_t)(end - line);
+        if (len > HOEDOWN_LINE_MAX - 1) {
+            len = HOEDOWN_LINE_MAX - 1;
+        }
+
+        buf = apr_pstrmemdup(p, line, len);
+
+        /* the first $title of a line is replaced */
+        title = strstr(buf, HOEDOWN_TITLE_MARKER);
+        if (title) {
+            segment->len += title - buf;
+            segment = apr_array_push(style->header);
+            segment->data = line + (title - buf)
+                + strlen(HOEDOWN_TITLE_MARKER);
+            segment->len = len - (title - buf)
+                - strlen(HOEDOWN_TITLE_MARKER);
+        } else {
+            segment->len += len;
+        }
+
+        if (apr_fnmatch("*"HOEDOWN_TAG"*", buf, APR_FNM_CASE_BLIND) == 0) {
+            style->body = 1;
+            style->footer = line + len;
+            style->footer_len = end - (line + len);
+            style->footer_offset = (line + len) - data;
+            break;
+        }
+    }
+
+    return style;
+}
+
+char *
+hoedown_page_title(apr_pool_t *p, char const *filename)
+{
+    char const *ps, *pe;
+
+    if (filename == NULL) {
+        return HOEDOWN_TITLE_DEFAULT;
+    }
+
+    /* basename without the extension */
+    ps = strrchr(filename, '/');
+    ps = ps ? ps + 1 : filename;
+    pe = strrchr(ps, '.');
+    if (pe == NULL) {
+        pe = ps + strlen(ps);
+    }
+
+    return apr_pstrndup(p, ps, pe - ps);
+}
+
+void
+hoedown_style_header(hoedown_buffer *ob, hoedown_style_t *style,
+                     char const *title)
+{
+    if (style) {
+        hoedown_style_segment_t *segment;
+        int i;
+
+        segment = (hoedown_style_segment_t *)style->header->elts;
+        for (i = 0; i < style->header->nelts; i++) {
+            if (i > 0) {
+                hoedown_buffer_puts(ob, title);
+            }
+            hoedown_buffer_put(ob, (uint8_t *)segment[i].data,
+                               segment[i].len);
+        }
+    } else {
+        hoedown_buffer_puts(ob, "<!DOCTYPE html>\n<html>\n");
+        hoedown_buffer_printf(ob, "<head><title>%s</title></head>\n",
+                              title);
+        hoedown_buffer_puts(ob, "<body>\n");
+    }
+}
+
+void
+hoedown_style_footer(hoedown_buffer *ob, hoedown_style_t *style)
+{
+    if (style != NULL && style->body) {
+        hoedown_buffer_put(ob, (uint8_t *)style->footer, style->footer_len);
+    } else {
+        hoedown_buffer_puts(ob, "</body>\n</html>\n");
+    }
+}
+
+/* single-pass toc: headers are fed to the toc renderer during body render */
+typedef struct {
+    hoedown_renderer *renderer;
+    hoedown_renderer_data data;
+    hoedown_buffer *ob;
+    void (*header)(hoedown_buffer *ob, const hoedown_buffer *content,
+#ifdef HOEDOWN_VERSION_EXTRAS
+                   const hoedown_buffer *attr,
+#endif
+                   int level, const hoedown_renderer_data *data);
+    int (*raw_html)(hoedown_buffer *ob, const hoedown_buffer *text,
+                    const hoedown_renderer_data *data);
+    int has_raw_html;
+    int fallback;
+} hoedown_toc_collector_t;
+
+static hoedown_renderer *
+toc_renderer_new(hoedown_config_rec *cfg, int toc_begin, int toc_end)
+{
+    hoedown_renderer *renderer;
+    hoedown_html_renderer_state *state;
+
+    renderer = hoedown_html_toc_renderer_new(0);
+    state = (hoedown_html_renderer_state *)renderer->opaque;
+
+    state->flags = cfg->html;
+    state->toc_data.level_offset = toc_begin;
+    state->toc_data.nesting_level = toc_end;
+#ifdef HOEDOWN_VERSION_EXTRAS
+    state->toc_data.header = cfg->toc.header;
+    state->toc_data.footer = cfg->toc.footer;
+    state->toc_data.unescape = cfg->toc.unescape;
+#endif
+
+    return renderer;
+}
+
+/*
+ * Header content the toc renderer would produce differently: any markup
+ * other than the plain span tags both renderers emit identically.
+ */
+static int
+toc_content_plain(const hoedown_buffer *content)
+{
+    static const char *tags[] = {
+        "code>", "em>", "strong>", "del>", "u>", "mark>", "q>", "sup>", NULL
+    };
+    const uint8_t *p, *end;
+
+    if (!content) {
+        return 1;
+    }
+
+    p = content->data;
+    end = content->data + content->size;
+
+    while ((p = memchr(p, '<', end - p)) != NULL) {
+        const char **tag;
+        size_t len;
+
+        if (++p < end && *p == '/') {
+            p++;
+        }
+
+        for (tag = tags; *tag; tag++) {
+            len = strlen(*tag);
+            if ((size_t)(end - p) >= len && memcmp(p, *tag, len) == 0) {
+                break;
+            }
+        }
+        if (!*tag) {
+            return 0;
+        }
+        p += len;
+    }
+
+    return 1;
+}
+
+static int
+toc_collect_raw_html(hoedown_buffer *ob, const hoedown_buffer *text,
+                     const hoedown_renderer_data *data)
+{
+    hoedown_html_renderer_state *state = data->opaque;
+    hoedown_toc_collector_t *collector = state->opaque;
+
+    collector->has_raw_html = 1;
+
+    return collector->raw_html(ob, text, data);
+}
+
+static void
+toc_collect_header(hoedown_buffer *ob, const hoedown_buffer *content,
+#ifdef HOEDOWN_VERSION_EXTRAS
+                   const hoedown_buffer *attr,
+#endif
+                   int level, const hoedown_renderer_data *data)
+{
+    hoedown_html_renderer_state *state = data->opaque;
+    hoedown_toc_collector_t *collector = state->opaque;
+
+    collector->header(ob, content,
+#ifdef HOEDOWN_VERSION_EXTRAS
+                      attr,
+#endif
+                      level, data);
+
+    if (!collector->fallback) {
+        if (collector->has_raw_html || !toc_content_plain(content)) {
+            collector->fallback = 1;
+        } else {
+            collector->renderer->header(collector->ob, content,
+#ifdef HOEDOWN_VERSION_EXTRAS
+                                        attr,
+#endif
+                                        level, &collector->data);
+        }
+    }
+
+    collector->has_raw_html = 0;
+}
+
+/*
+ * A document with its renderers, set up once for a render profile and
+ * reset between renders: the renderer states are restored from the copy
+ * taken after set up, the document resets itself.
+ */
+struct hoedown_context_s {
+    hoedown_renderer *html;
+    hoedown_renderer *toc;
+    hoedown_document *document;
+    hoedown_document *toc_document;
+    hoedown_html_renderer_state html_state;
+    hoedown_html_renderer_state toc_state;
+    void (*header)(hoedown_buffer *ob, const hoedown_buffer *content,
+#ifdef HOEDOWN_VERSION_EXTRAS
+                   const hoedown_buffer *attr,
+#endif
+                   int level, const hoedown_renderer_data *data);
+    int (*raw_html)(hoedown_buffer *ob, const hoedown_buffer *text,
+                    const hoedown_renderer_data *data);
+    hoedown_config_rec cfg;
+    size_t max_nesting;
+    int collect;
+};
+
+/* the renderers point to these strings: the context keeps its own */
+static char *
+context_strdup(const char *s)
+{
+    return s ? strdup(s) : NULL;
+}
+
+/*
+ * Whether the toc can be collected during the body render: the toc
+ * renderer drops or escapes these, and has no math callback.
+ */
+static int
+toc_collectable(hoedown_config_rec *cfg)
+{
+    if (cfg->html & (HOEDOWN_HTML_SKIP_HTML | HOEDOWN_HTML_SKIP_STYLE |
+                     HOEDOWN_HTML_SKIP_IMAGES | HOEDOWN_HTML_SKIP_LINKS |
+                     HOEDOWN_HTML_ESCAPE)) {
+        return 0;
+    }
+
+    if (cfg->extensions & HOEDOWN_EXT_MATH) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/* hook the collector into the body renderer, for the document to copy */
+static void
+toc_collect_hook(hoedown_context_t *ctx)
+{
+    ctx->header = ctx->html->header;
+    ctx->html->header = toc_collect_header;
+    if (ctx->html->raw_html) {
+        ctx->raw_html = ctx->html->raw_html;
+        ctx->html->raw_html = toc_collect_raw_html;
+    }
+}
+
+static void
+toc_collect_init(hoedown_toc_collector_t *collector, hoedown_context_t *ctx,
+                 hoedown_buffer *ob)
+{
+    hoedown_html_renderer_state *state;
+
+    memset(collector, 0, sizeof(*collector));
+
+    collector->renderer = ctx->toc;
+    collector->data.opaque = ctx->toc->opaque;
+    collector->ob = ob;
+    collector->header = ctx->header;
+    collector->raw_html = ctx->raw_html;
+
+    if (!ctx->collect) {
+        collector->fallback = 1;
+        return;
+    }
+
+    state = (hoedown_html_renderer_state *)ctx->html->opaque;
+    state->opaque = collector;
+
+    if (ctx->toc->doc_header) {
+        ctx->toc->doc_header(ob, 0, &collector->data);
+    }
+}
+
+/* close the collected toc, or render it in a separate pass on fallback */
+static void
+toc_collect_finish(hoedown_toc_collector_t *collector, hoedown_context_t *ctx,
+                   const uint8_t *data, size_t size)
+{
+    if (!collector->fallback) {
+        if (ctx->toc->doc_footer) {
+            ctx->toc->doc_footer(collector->ob, 0, &collector->data);
+        }
+        return;
+    }
+
+    hoedown_buffer_reset(collector->ob);
+    *(hoedown_html_renderer_state *)ctx->toc->opaque = ctx->toc_state;
+
+    if (ctx->toc_document == NULL) {
+        ctx->toc_document = hoedown_document_new(ctx->toc,
+                                                 ctx->cfg.extensions,
+                                                 ctx->max_nesting);
+    }
+    hoedown_document_render(ctx->toc_document, collector->ob, data, size);
+}
+
+/* contexts outlive requests: they are allocated from the heap */
+hoedown_context_t *
+hoedown_context_new(hoedown_config_rec *cfg, int toc_begin, int toc_end,
+                    int toc)
+{
+    hoedown_context_t *ctx;
+    apr_pool_t *arena;
+#ifdef HOEDOWN_VERSION_EXTRAS
+    hoedown_html_renderer_state *state;
+#endif
+
+    arena = hoedown_arena_set(NULL);
+
+    ctx = calloc(1, sizeof(hoedown_context_t));
+    if (ctx == NULL) {
+        hoedown_arena_set(arena);
+        return NULL;
+    }
+
+    ctx->cfg = *cfg;
+    ctx->cfg.class.ul = context_strdup(cfg->class.ul);
+    ctx->cfg.class.ol = context_strdup(cfg->class.ol);
+    ctx->cfg.class.task = context_strdup(cfg->class.task);
+    ctx->cfg.toc.header = context_strdup(cfg->toc.header);
+    ctx->cfg.toc.footer = context_strdup(cfg->toc.footer);
+    cfg = &ctx->cfg;
+
+    ctx->max_nesting = cfg->max_nesting > 0
+        ? (size_t)cfg->max_nesting : HOEDOWN_MAX_NESTING;
+
+    /* markdown render */
+    ctx->html = hoedown_html_renderer_new(cfg->html, toc_end);
+
+#ifdef HOEDOWN_VERSION_EXTRAS
+    state = (hoedown_html_renderer_state *)ctx->html->opaque;
+    if ((state->flags & HOEDOWN_HTML_USE_TASK_LIST) && cfg->class.task) {
+        state->class_data.task = cfg->class.task;
+    }
+    if (cfg->class.ol) {
+        state->class_data.ol = cfg->class.ol;
+    }
+    if (cfg->class.ul) {
+        state->class_data.ul = cfg->class.ul;
+    }
+#endif
+
+    if (toc) {
+        ctx->toc = toc_renderer_new(cfg, toc_begin, toc_end);
+        ctx->toc_state = *(hoedown_html_renderer_state *)ctx->toc->opaque;
+        ctx->collect = toc_collectable(cfg);
+        if (ctx->collect) {
+            toc_collect_hook(ctx);
+        }
+    }
+
+    ctx->html_state = *(hoedown_html_renderer_state *)ctx->html->opaque;
+
+    ctx->document = hoedown_document_new(ctx->html, cfg->extensions,
+                                         ctx->max_nesting);
+
+    hoedown_arena_set(arena);
+
+    return ctx;
+}
+
+void
+hoedown_context_free(hoedown_context_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    hoedown_document_free(ctx->document);
+    if (ctx->toc_document) {
+        hoedown_document_free(ctx->toc_document);
+    }
+    if (ctx->toc) {
+        hoedown_html_renderer_free(ctx->toc);
+    }
+    hoedown_html_renderer_free(ctx->html);
+
+    free(ctx->cfg.class.ul);
+    free(ctx->cfg.class.ol);
+    free(ctx->cfg.class.task);
+    free(ctx->cfg.toc.header);
+    free(ctx->cfg.toc.footer);
+    free(ctx);
+}
+
+/* the settings a context is made from, as a key for reuse */
+char *
+hoedown_context_profile(apr_pool_t *p, hoedown_config_rec *cfg,
+                        int toc_begin, int toc_end, int toc)
+{
+    return apr_psprintf(p,
+                        "%x\n%x\n%d\n%d\n%d\n%d\n%d\n"
+                        "%s\n%s\n%s\n%s\n%s",
+                        cfg->extensions, cfg->html, cfg->max_nesting,
+                        toc, toc_begin, toc_end, cfg->toc.unescape,
+                        cfg->toc.header ? cfg->toc.header : "",
+                        cfg->toc.footer ? cfg->toc.footer : "",
+                        cfg->class.ul ? cfg->class.ul : "",
+                        cfg->class.ol ? cfg->class.ol : "",
+                        cfg->class.task ? cfg->class.task : "");
+}
+
+/*
+ * Render markdown into ob, and the toc into toc_ob when the context has
+ * one. Returns the time spent finishing the toc after the body render,
+ * which is the separate toc pass on fallback.
+ *
+ * The document keeps its work buffers for the next render, so they are
+ * allocated from the heap whatever the arena of the calling thread.
+ */
+apr_interval_time_t
+hoedown_context_render(hoedown_context_t *ctx, const uint8_t *data,
+                       size_t size, hoedown_buffer *toc_ob,
+                       hoedown_buffer *ob)
+{
+    hoedown_toc_collector_t collector;
+    apr_pool_t *arena;
+    apr_time_t start;
+    apr_interval_time_t toc_time = 0;
+
+    arena = hoedown_arena_set(NULL);
+
+    *(hoedown_html_renderer_state *)ctx->html->opaque = ctx->html_state;
+
+    if (ctx->toc && toc_ob) {
+        *(hoedown_html_renderer_state *)ctx->toc->opaque = ctx->toc_state;
+        toc_collect_init(&collector, ctx, toc_ob);
+    }
+
+    hoedown_document_render(ctx->document, ob, data, size);
+
+    if (ctx->toc && toc_ob) {
+        start = apr_time_now();
+        toc_collect_finish(&collector, ctx, data, size);
+        toc_time = apr_time_now() - start;
+    }
+
+    hoedown_arena_set(arena);
+
+    return toc_time;
+}
+
+/* one-off render, with a context of its own */
+apr_interval_time_t
+hoedown_render(hoedown_config_rec *cfg, int toc_begin, int toc_end,
+               const uint8_t *data, size_t size,
+               hoedown_buffer *toc_ob, hoedown_buffer *ob)
+{
+    hoedown_context_t *ctx;
+    apr_interval_time_t toc_time;
+
+    ctx = hoedown_context_new(cfg, toc_begin, toc_end, toc_ob != NULL);
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    toc_time = hoedown_context_render(ctx, data, size, toc_ob, ob);
+
+    hoedown_context_free(ctx);
+
+    return toc_time;
+}
+
+/* block kinds that continue across blank lines */
+typedef enum {
+    CHUNK_TEXT,
+    CHUNK_LIST,
+    CHUNK_QUOTE,
+    CHUNK_HTML
+} chunk_kind_t;
+
+static chunk_kind_t
+chunk_kind(const uint8_t *line, const uint8_t *end)
+{
+    const uint8_t *p = line;
+
+    if (*p == '>') {
+        return CHUNK_QUOTE;
+    }
+    if (*p == '<' && p + 1 < end && (apr_isalpha(p[1]) || p[1] == '!')) {
+        return CHUNK_HTML;
+    }
+    if ((*p == '-' || *p == '*' || *p == '+')
+        && p + 1 < end && (p[1] == ' ' || p[1] == '\t')) {
+        return CHUNK_LIST;
+    }
+    while (p < end && apr_isdigit(*p)) {
+        p++;
+    }
+    if (p > line && p + 1 < end && *p == '.'
+        && (p[1] == ' ' || p[1] == '\t')) {
+        return CHUNK_LIST;
+    }
+
+    return CHUNK_TEXT;
+}
+
+/* whether a title is next to the url of a link reference, as hoedown sees it */
+static int
+chunk_ref_title(const uint8_t *p)
+{
+    return *p == '\'' || *p == '"' || *p == '(';
+}
+
+/*
+ * Whether a [id]: line is a link reference hoedown surely takes out of
+ * the text: the url and any title on the line, no title on the next
+ * line, no footnote. 0 when in doubt.
+ */
+static int
+chunk_ref(const uint8_t *q, const uint8_t *eol, const uint8_t *end,
+          const uint8_t **id, size_t *id_size)
+{
+    const uint8_t *e = (eol > q && eol[-1] == '\n') ? eol - 1 : eol;
+    const uint8_t *p, *c, *url, *t;
+
+    if (memchr(q, '\r', eol - q) || q + 1 >= e || q[1] == '^') {
+        return 0;
+    }
+
+    c = memchr(q + 1, ']', e - (q + 1));
+    if (c == NULL || c + 1 >= e || c[1] != ':') {
+        return 0;
+    }
+    *id = q + 1;
+    *id_size = c - (q + 1);
+
+    /* the url, on this line */
+    for (p = c + 2; p < e && *p == ' '; p++);
+    if (p < e && *p == '<') {
+        p++;
+    }
+    for (url = p; p < e && *p != ' '; p++);
+    if ((p > url && p[-1] == '>' ? p - 1 : p) == url) {
+        return 0;
+    }
+    for (; p < e && *p == ' '; p++);
+
+    if (p == e) {
+        /* a title may follow on the next line */
+        for (p = eol; p < end && *p == ' '; p++);
+        return !(p < end && chunk_ref_title(p));
+    }
+    if (!chunk_ref_title(p)) {
+        return 0;
+    }
+
+    /* the title ends the line */
+    for (t = e - 1; t > p + 1 && *t == ' '; t--);
+
+    return t > p + 1 && (*t == '\'' || *t == '"' || *t == ')');
+}
+
+/*
+ * Split markdown at the top level blocks that render alone to what they
+ * render to in the whole document: a block starts at an unindented line
+ * after a blank line, out of fenced code, and does not continue the list,
+ * quote or html block before it.
+ *
+ * hoedown takes link references out of the text before parsing, wherever
+ * they are: with refs, they are left in their block and copied to refs
+ * for the other blocks to be rendered with. NULL when the blocks are not
+ * independent: footnotes, and link references without refs or that are
+ * defined twice or not surely references.
+ */
+apr_array_header_t *
+hoedown_chunks(apr_pool_t *p, hoedown_config_rec *cfg,
+               const uint8_t *data, size_t size, hoedown_chunk_t *refs)
+{
+    apr_array_header_t *chunks, *defs = NULL;
+    apr_hash_t *ids = NULL;
+    hoedown_chunk_t *chunk;
+    const uint8_t *line = data, *eol, *end = data + size, *start = data;
+    chunk_kind_t kind = CHUNK_TEXT;
+    int blank = 0, fence = 0, closed = 0, i;
+    uint8_t fence_char = 0, *copy;
+    size_t fence_len = 0;
+
+    chunks = apr_array_make(p, 64, sizeof(hoedown_chunk_t));
+
+    for (; line < end; line = eol) {
+        const uint8_t *q = line;
+        size_t indent, n;
+        int opens = 0;
+
+        eol = memchr(line, '\n', end - line);
+        eol = eol ? eol + 1 : end;
+
+        for (indent = 0; q < eol && *q == ' ' && indent < 4; indent++) {
+            q++;
+        }
+
+        /* [ref]: url, [^note]: text, *[abbr]: text, fenced or not */
+        if (indent < 4 && q < eol) {
+            const uint8_t *b = (*q == '*') ? q + 1 : q;
+
+            if (b < eol && *b == '[') {
+                const uint8_t *c = memchr(b, ']', eol - b), *id;
+                size_t id_size;
+
+                if (c && c + 1 < eol && c[1] == ':') {
+                    if (refs == NULL || b != q
+                        || !chunk_ref(q, eol, end, &id, &id_size)) {
+                        return NULL;
+                    }
+
+                    /* ids are compared without case */
+                    if (ids == NULL) {
+                        ids = apr_hash_make(p);
+                        defs = apr_array_make(p, 16,
+                                              sizeof(hoedown_chunk_t));
+                    }
+                    copy = apr_pmemdup(p, id, id_size);
+                    for (n = 0; n < id_size; n++) {
+                        copy[n] = apr_tolower(copy[n]);
+                    }
+                    if (apr_hash_get(ids, copy, id_size)) {
+                        return NULL;
+                    }
+                    apr_hash_set(ids, copy, id_size, copy);
+
+                    chunk = (hoedown_chunk_t *)apr_array_push(defs);
+                    chunk->data = line;
+                    chunk->size = eol - line;
+
+                    /* out of the text, as if the line was not there */
+                    continue;
+                }
+            }
+        }
+
+        /* fenced code: no blocks inside */
+        if ((cfg->extensions & HOEDOWN_EXT_FENCED_CODE) && indent < 4
+            && q < eol && (*q == '`' || *q == '~')
+            && (!fence || *q == fence_char)) {
+            for (n = 0; q + n < eol && q[n] == *q; n++);
+            if (n >= 3 && (!fence || n >= fence_len)) {
+                if (fence) {
+                    fence = 0;
+                    blank = 0;
+                    continue;
+                }
+                opens = 1;
+                fence_char = *q;
+                fence_len = n;
+            }
+        }
+        if (fence) {
+            continue;
+        }
+
+        for (n = 0; q + n < eol && apr_isspace(q[n]); n++);
+        if (q + n == eol) {
+            blank = 1;
+            continue;
+        }
+
+        if (blank && line != start && indent == 0) {
+            chunk_kind_t next = chunk_kind(line, eol);
+
+            if (!((next == CHUNK_LIST && kind == CHUNK_LIST)
+                  || (next == CHUNK_QUOTE && kind == CHUNK_QUOTE)
+                  || (kind == CHUNK_HTML && !closed))) {
+                chunk = (hoedown_chunk_t *)apr_array_push(chunks);
+                chunk->data = start;
+                chunk->size = line - start;
+                start = line;
+                kind = next;
+                closed = 0;
+            }
+        } else if (line == start) {
+            kind = chunk_kind(line, eol);
+        }
+
+        /* the end tag of an html block */
+        if (kind == CHUNK_HTML && line[0] == '<' && line + 1 < eol
+            && line[1] == '/') {
+            closed = 1;
+        }
+
+        fence = opens;
+        blank = 0;
+    }
+
+    if (start < end) {
+        chunk = (hoedown_chunk_t *)apr_array_push(chunks);
+        chunk->data = start;
+        chunk->size = end - start;
+    }
+
+    if (refs) {
+        refs->data = NULL;
+        refs->size = 0;
+    }
+    if (defs) {
+        /* a line each */
+        chunk = (hoedown_chunk_t *)defs->elts;
+        for (i = 0; i < defs->nelts; i++) {
+            refs->size += chunk[i].size + 1;
+        }
+        copy = apr_palloc(p, refs->size);
+        refs->data = copy;
+        refs->size = 0;
+        for (i = 0; i < defs->nelts; i++) {
+            memcpy(copy + refs->size, chunk[i].data, chunk[i].size);
+            refs->size += chunk[i].size;
+            if (chunk[i].data[chunk[i].size - 1] != '\n') {
+                copy[refs->size++] = '\n';
+            }
+        }
+    }
+
+    return chunks;
+}
+
+/*
+ * The markdown of consecutive top level blocks, rendered as a document
+ * of its own: after the link references of the whole document, if any.
+ */
+const uint8_t *
+hoedown_chunk_source(apr_pool_t *p, const uint8_t *data,
+                     hoedown_chunk_t *refs, const uint8_t *begin,
+                     size_t size, size_t *source_size)
+{
+    uint8_t *copy;
+
+    if (refs->size == 0) {
+        *source_size = size;
+        return begin;
+    }
+
+    /* hoedown only skips a BOM at the start */
+    if (begin == data && size >= 3 && memcmp(begin, "\xef\xbb\xbf", 3) == 0) {
+        begin += 3;
+        size -= 3;
+    }
+
+    copy = apr_palloc(p, refs->size + size);
+    memcpy(copy, refs->data, refs->size);
+    memcpy(copy + refs->size, begin, size);
+    *source_size = refs->size + size;
+
+    return copy;
+}
+
+/* a part rendered after a newline: joined to the page without it */
+void
+hoedown_chunk_join(hoedown_buffer *ob, hoedown_buffer *part)
+{
+    const uint8_t *html = part->data + 1;
+    apr_size_t html_size = part->size - 1;
+
+    if (ob->size == 0 && html_size > 0 && html[0] == '\n') {
+        html++;
+        html_size--;
+    }
+    hoedown_buffer_put(ob, html, html_size);
+}
+
+/* "#"s of an atx header, 0 when the line is not one */
+static int
+heading_atx(hoedown_config_rec *cfg, const uint8_t *line, const uint8_t *eol)
+{
+    int level = 0;
+
+    while (line + level < eol && line[level] == '#') {
+        level++;
+    }
+    if (level == 0 || level > 6) {
+        return 0;
+    }
+    if ((cfg->extensions & HOEDOWN_EXT_SPACE_HEADERS)
+        && line + level < eol && line[level] != ' '
+        && line[level] != '\t') {
+        return 0;
+    }
+
+    return level;
+}
+
+/* level of a setext underline, 0 when the line is not one */
+static int
+heading_setext(const uint8_t *line, const uint8_t *eol)
+{
+    const uint8_t *p = line;
+
+    if (*p != '=' && *p != '-') {
+        return 0;
+    }
+    while (p < eol && *p == *line) {
+        p++;
+    }
+    while (p < eol && apr_isspace(*p)) {
+        p++;
+    }
+    if (p != eol) {
+        return 0;
+    }
+
+    return *line == '=' ? 1 : 2;
+}
+
+/*
+ * Index of the top level headings: their source, level, the anchor the
+ * toc renderer gives them (each heading is run through it alone: anchors
+ * only depend on the heading text) and the end of their section, at the
+ * next heading of the same or a higher level.
+ */
+apr_array_header_t *
+hoedown_headings(apr_pool_t *p, hoedown_config_rec *cfg,
+                 const uint8_t *data, size_t size)
+{
+    apr_array_header_t *headings;
+    hoedown_heading_t *heading;
+    hoedown_config_rec toc_cfg = *cfg;
+    hoedown_renderer *renderer;
+    hoedown_html_renderer_state state;
+    hoedown_document *document;
+    hoedown_buffer *ob;
+    const uint8_t *line = data, *eol, *end = data + size, *prev = NULL;
+    uint8_t fence_char = 0;
+    size_t fence_len = 0, n;
+    int fence = 0, i, j, level;
+
+    headings = apr_array_make(p, 16, sizeof(hoedown_heading_t));
+
+    for (; line < end; line = eol) {
+        eol = memchr(line, '\n', end - line);
+        eol = eol ? eol + 1 : end;
+
+        if ((cfg->extensions & HOEDOWN_EXT_FENCED_CODE)
+            && (*line == '`' || *line == '~')
+            && (!fence || *line == fence_char)) {
+            for (n = 0; line + n < eol && line[n] == *line; n++);
+            if (n >= 3 && (!fence || n >= fence_len)) {
+                fence = !fence;
+                fence_char = *line;
+                fence_len = n;
+                prev = NULL;
+                continue;
+            }
+        }
+        if (fence) {
+            continue;
+        }
+
+        level = heading_atx(cfg, line, eol);
+        if (level) {
+            heading = (hoedown_heading_t *)apr_array_push(headings);
+            heading->offset = line - data;
+            heading->length = eol - line;
+            heading->level = level;
+            prev = NULL;
+            continue;
+        }
+
+        /* the text line above an underline, in a paragraph */
+        if (prev && (level = heading_setext(line, eol)) != 0) {
+            heading = (hoedown_heading_t *)apr_array_push(headings);
+            heading->offset = prev - data;
+            heading->length = eol - prev;
+            heading->level = level;
+            prev = NULL;
+            continue;
+        }
+
+        for (n = 0; line + n < eol && apr_isspace(line[n]); n++);
+        if (line + n == eol || n > 0 || *line == '>' || *line == '<'
+            || ((*line == '-' || *line == '*' || *line == '+')
+                && line + 1 < eol && apr_isspace(line[1]))) {
+            prev = NULL;
+        } else {
+            prev = line;
+        }
+    }
+
+    /* sections */
+    heading = (hoedown_heading_t *)headings->elts;
+    for (i = 0; i < headings->nelts; i++) {
+        heading[i].end = size;
+        for (j = i + 1; j < headings->nelts; j++) {
+            if (heading[j].level <= heading[i].level) {
+                heading[i].end = heading[j].offset;
+                break;
+            }
+        }
+    }
+
+    /* anchors */
+    toc_cfg.toc.header = NULL;
+    toc_cfg.toc.footer = NULL;
+    renderer = toc_renderer_new(&toc_cfg, 1, 6);
+    state = *(hoedown_html_renderer_state *)renderer->opaque;
+    document = hoedown_document_new(renderer, cfg->extensions,
+                                    cfg->max_nesting > 0
+                                    ? cfg->max_nesting : HOEDOWN_MAX_NESTING);
+    ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+
+    for (i = 0; i < headings->nelts; i++) {
+        const char *href, *quote;
+
+        hoedown_buffer_reset(ob);
+        *(hoedown_html_renderer_state *)renderer->opaque = state;
+        hoedown_document_render(document, ob, data + heading[i].offset,
+                                heading[i].length);
+
+        heading[i].anchor = NULL;
+        href = hoedown_buffer_cstr(ob);
+        href = href ? strstr(href, "href=\"#") : NULL;
+        if (href) {
+            href += 7;
+            quote = strchr(href, '"');
+            if (quote) {
+                heading[i].anchor = apr_pstrmemdup(p, href, quote - href);
+            }
+        }
+    }
+
+    hoedown_buffer_free(ob);
+    hoedown_document_free(document);
+    hoedown_html_renderer_free(renderer);
+
+    return headings;
+}
+
+char *
+hoedown_page_fingerprint(apr_pool_t *p, hoedown_config_rec *cfg,
+                         char const *filename, apr_finfo_t *finfo,
+                         char const *style_filepath,
+                         apr_finfo_t *style_finfo, char const *title,
+                         char const *toc)
+{
+    unsigned char digest[APR_MD5_DIGESTSIZE];
+    char *key, *hex;
+    int i;
+
+    key = apr_psprintf(p,
+                       "%s\n%" APR_TIME_T_FMT "\n%" APR_OFF_T_FMT "\n"
+                       "%s\n%" APR_TIME_T_FMT "\n%" APR_OFF_T_FMT "\n"
+                       "%x\n%x\n%d\n%d\n%d\n%d\n%s\n%s\n%s\n%s\n%s\n%s\n%s",
+                       filename, finfo->mtime, finfo->size,
+                       style_filepath ? style_filepath : "",
+                       style_filepath ? style_finfo->mtime : 0,
+                       style_filepath ? style_finfo->size : 0,
+                       cfg->extensions, cfg->html, cfg->max_nesting,
+                       cfg->toc.begin, cfg->toc.end, cfg->toc.unescape,
+                       cfg->toc.header ? cfg->toc.header : "",
+                       cfg->toc.footer ? cfg->toc.footer : "",
+                       cfg->class.ul ? cfg->class.ul : "",
+                       cfg->class.ol ? cfg->class.ol : "",
+                       cfg->class.task ? cfg->class.task : "",
+                       title ? title : "", toc ? toc : "");
+
+    apr_md5(digest, key, strlen(key));
+
+    hex = apr_palloc(p, APR_MD5_DIGESTSIZE * 2 + 1);
+    for (i = 0; i < APR_MD5_DIGESTSIZE; i++) {
+        apr_snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+
+    return hex;
+}
+
+/* first line of a pre-rendered sidecar */
+char *
+hoedown_sidecar_header(apr_pool_t *p, char const *fingerprint)
+{
+    return apr_pstrcat(p, HOEDOWN_SIDECAR_MAGIC, fingerprint,
+                       HOEDOWN_SIDECAR_END, NULL);
+}
+
+#ifdef HAVE_ZLIB
+apr_status_t
+hoedown_compress_gzip(apr_pool_t *p,
+                      unsigned char const *data, apr_size_t size,
+                      unsigned char **out, apr_size_t *outlen)
+{
+    z_stream zs;
+    apr_size_t bound;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, HOEDOWN_GZIP_LEVEL, Z_DEFLATED, MAX_WBITS + 16,
+                     MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return APR_EGENERAL;
+    }
+
+    bound = deflateBound(&zs, size);
+    *out = apr_palloc(p, bound);
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = size;
+    zs.next_out = *out;
+    zs.avail_out = bound;
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&zs);
+        return APR_EGENERAL;
+    }
+    *outlen = zs.total_out;
+
+    deflateEnd(&zs);
+
+    return APR_SUCCESS;
+}
+#endif
+
+#ifdef HAVE_BROTLI
+apr_status_t
+hoedown_compress_brotli(apr_pool_t *p,
+                        unsigned char const *data, apr_size_t size,
+                        unsigned char **out, apr_size_t *outlen)
+{
+    *outlen = BrotliEncoderMaxCompressedSize(size);
+    if (*outlen == 0) {
+        return APR_EGENERAL;
+    }
+    *out = apr_palloc(p, *outlen);
+
+    if (!BrotliEncoderCompress(HOEDOWN_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW,
+                               BROTLI_MODE_TEXT, size, data, outlen, *out)) {
+        return APR_EGENERAL;
+    }
+
+    return APR_SUCCESS;
+}
+#endif
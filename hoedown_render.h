@@ -0,0 +1,196 @@
+/*
+**  hoedown_render.h -- rendering shared by mod_hoedown and hoedown-prerender
+*/
+
+#ifndef HOEDOWN_RENDER_H
+#define HOEDOWN_RENDER_H
+
+/* apr */
+#include "apr_pools.h"
+#include "apr_file_info.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+/* hoedown */
+#include "hoedown/src/version.h"
+#include "hoedown/src/document.h"
+#include "hoedown/src/html.h"
+#include "hoedown/src/buffer.h"
+
+#define HOEDOWN_OUTPUT_UNIT     64
+#define HOEDOWN_PAGE_UNIT       1024
+#define HOEDOWN_LINE_MAX        8192
+#define HOEDOWN_TITLE_DEFAULT   "Markdown"
+#define HOEDOWN_TITLE_MARKER    "$title"
+#define HOEDOWN_TAG             "<body*>"
+#define HOEDOWN_STYLE_EXT       ".html"
+#define HOEDOWN_DIRECTORY_INDEX "index.md"
+#define HOEDOWN_TOC_BEGIN        2
+#define HOEDOWN_TOC_END          6
+#define HOEDOWN_MAX_NESTING      16
+#define HOEDOWN_GZIP_LEVEL       9
+#define HOEDOWN_BROTLI_QUALITY   9
+#define HOEDOWN_EXTENSIONS_DEFAULT                                     \
+    (HOEDOWN_EXT_TABLES | HOEDOWN_EXT_FENCED_CODE | HOEDOWN_EXT_AUTOLINK | \
+     HOEDOWN_EXT_STRIKETHROUGH | HOEDOWN_EXT_NO_INTRA_EMPHASIS)
+#define HOEDOWN_SIDECAR_EXT      ".html"
+#define HOEDOWN_SIDECAR_GZIP_EXT ".html.gz"
+#define HOEDOWN_SIDECAR_MAGIC    "<!-- hoedown:"
+#define HOEDOWN_SIDECAR_END      " -->\n"
+
+typedef struct {
+    char *default_page;
+    char *directory_index;
+    struct {
+        char *path;
+        char *name;
+        char *ext;
+    } style;
+    struct {
+        char *ul;
+        char *ol;
+        char *task;
+    } class;
+    struct {
+        int begin;
+        int end;
+        int unescape;
+        char *header;
+        char *footer;
+    } toc;
+    struct {
+        int ttl;
+        int max_entry;
+    } cache;
+    struct {
+        int timeout;
+        int max_size;
+        int cache_ttl;
+        apr_array_header_t *allow;
+    } url;
+    int compression;
+    int prerendered;
+    int mmap_threshold;
+    int max_nesting;
+    int coalesce;
+    int max_input_size;
+    int incremental;
+    int parallel;
+    int stat_interval;
+    int render_budget;
+    int raw;
+    unsigned int extensions;
+    unsigned int html;
+} hoedown_config_rec;
+
+typedef struct {
+    char const *data;
+    apr_size_t len;
+} hoedown_style_segment_t;
+
+typedef struct {
+    apr_pool_t *pool;
+    char *filepath;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_array_header_t *header;
+    char const *footer;
+    apr_size_t footer_len;
+    apr_off_t footer_offset;
+    int body;
+    int refs;
+    int stale;
+} hoedown_style_t;
+
+/* Hoedown* directives: value is a flag bit or a hoedown_config_rec offset */
+typedef enum {
+    HOEDOWN_OPTION_EXTENSION,
+    HOEDOWN_OPTION_RENDER,
+    HOEDOWN_OPTION_STRING,
+    HOEDOWN_OPTION_INT,
+    HOEDOWN_OPTION_FLAG
+} hoedown_option_type_t;
+
+typedef struct {
+    char const *name;
+    hoedown_option_type_t type;
+    unsigned int value;
+} hoedown_option_t;
+
+extern const hoedown_option_t hoedown_options[];
+
+/* style template */
+hoedown_style_t *hoedown_style_parse(apr_pool_t *p, char const *filepath,
+                                     apr_finfo_t *finfo);
+char *hoedown_page_title(apr_pool_t *p, char const *filename);
+void hoedown_style_header(hoedown_buffer *ob, hoedown_style_t *style,
+                          char const *title);
+void hoedown_style_footer(hoedown_buffer *ob, hoedown_style_t *style);
+
+/* markdown */
+typedef struct hoedown_context_s hoedown_context_t;
+
+/* reusable document and renderers: a toc_ob is given iff made with toc */
+hoedown_context_t *hoedown_context_new(hoedown_config_rec *cfg,
+                                       int toc_begin, int toc_end, int toc);
+void hoedown_context_free(hoedown_context_t *ctx);
+char *hoedown_context_profile(apr_pool_t *p, hoedown_config_rec *cfg,
+                              int toc_begin, int toc_end, int toc);
+apr_interval_time_t hoedown_context_render(hoedown_context_t *ctx,
+                                           const uint8_t *data, size_t size,
+                                           hoedown_buffer *toc_ob,
+                                           hoedown_buffer *ob);
+apr_interval_time_t hoedown_render(hoedown_config_rec *cfg,
+                                   int toc_begin, int toc_end,
+                                   const uint8_t *data, size_t size,
+                                   hoedown_buffer *toc_ob, hoedown_buffer *ob);
+
+/* top level blocks, rendered one by one */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} hoedown_chunk_t;
+
+apr_array_header_t *hoedown_chunks(apr_pool_t *p, hoedown_config_rec *cfg,
+                                   const uint8_t *data, size_t size,
+                                   hoedown_chunk_t *refs);
+const uint8_t *hoedown_chunk_source(apr_pool_t *p, const uint8_t *data,
+                                    hoedown_chunk_t *refs,
+                                    const uint8_t *begin, size_t size,
+                                    size_t *source_size);
+void hoedown_chunk_join(hoedown_buffer *ob, hoedown_buffer *part);
+
+/* headings: the source of the heading and its section */
+typedef struct {
+    apr_size_t offset;
+    apr_size_t length;
+    apr_size_t end;
+    int level;
+    char *anchor;
+} hoedown_heading_t;
+
+apr_array_header_t *hoedown_headings(apr_pool_t *p, hoedown_config_rec *cfg,
+                                     const uint8_t *data, size_t size);
+
+/* validators */
+char *hoedown_page_fingerprint(apr_pool_t *p, hoedown_config_rec *cfg,
+                               char const *filename, apr_finfo_t *finfo,
+                               char const *style_filepath,
+                               apr_finfo_t *style_finfo, char const *title,
+                               char const *toc);
+char *hoedown_sidecar_header(apr_pool_t *p, char const *fingerprint);
+
+/* content codings */
+#ifdef HAVE_ZLIB
+apr_status_t hoedown_compress_gzip(apr_pool_t *p,
+                                   unsigned char const *data, apr_size_t size,
+                                   unsigned char **out, apr_size_t *outlen);
+#endif
+#ifdef HAVE_BROTLI
+apr_status_t hoedown_compress_brotli(apr_pool_t *p,
+                                     unsigned char const *data,
+                                     apr_size_t size,
+                                     unsigned char **out, apr_size_t *outlen);
+#endif
+
+#endif /* HOEDOWN_RENDER_H */
@@ -0,0 +1,186 @@
+/*
+**  hoedown_scan.c -- byte set scanning for mod_hoedown
+*/
+
+#include <string.h>
+
+#include "hoedown_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) \
+    && (defined(__GNUC__) || defined(__clang__))
+#  define HOEDOWN_SCAN_X86 1
+#  include <immintrin.h>
+#endif
+
+static size_t
+scan_scalar(const hoedown_scan_t *scan, const uint8_t *data, size_t size)
+{
+    size_t i = 0;
+
+    while (i < size && scan->table[data[i]] == 0) {
+        i++;
+    }
+
+    return i;
+}
+
+#ifdef HOEDOWN_SCAN_X86
+/* the bytes one at a time, compared to each of the set */
+static size_t
+scan_sse2(const hoedown_scan_t *scan, const uint8_t *data, size_t size)
+{
+    size_t i = 0;
+    int c, mask;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hit = scan->high ? v : _mm_setzero_si128();
+
+        for (c = 0; c < scan->nchars; c++) {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(
+                                   v, _mm_set1_epi8((char)scan->chars[c])));
+        }
+
+        mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz((unsigned int)mask);
+        }
+    }
+
+    return i + scan_scalar(scan, data + i, size - i);
+}
+
+/*
+ * The set as a bitmap of 8 rows (high nibble 0 to 7, ASCII) by 16
+ * columns (low nibble): a byte is in the set when the column of its low
+ * nibble has the bit of its high nibble, which is 0 above 0x7f. Those
+ * are all in the set or none.
+ */
+__attribute__((target("avx2")))
+static size_t
+scan_avx2(const hoedown_scan_t *scan, const uint8_t *data, size_t size)
+{
+    const __m256i lo = _mm256_loadu_si256((const __m256i *)scan->lo);
+    const __m256i hi = _mm256_loadu_si256((const __m256i *)scan->hi);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    unsigned int mask;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i rows = _mm256_shuffle_epi8(
+            lo, _mm256_and_si256(v, nibble));
+        __m256i cols = _mm256_shuffle_epi8(
+            hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(rows, cols), zero);
+
+        mask = ~(unsigned int)_mm256_movemask_epi8(miss);
+        if (scan->high) {
+            mask |= (unsigned int)_mm256_movemask_epi8(v);
+        }
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + scan_scalar(scan, data + i, size - i);
+}
+#endif
+
+hoedown_scan_level_t
+hoedown_scan_cpu(void)
+{
+#ifdef HOEDOWN_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return HOEDOWN_SCAN_AVX2;
+    }
+    return HOEDOWN_SCAN_SSE2;
+#else
+    return HOEDOWN_SCAN_SCALAR;
+#endif
+}
+
+char const *
+hoedown_scan_level_name(hoedown_scan_level_t level)
+{
+    switch (level) {
+        case HOEDOWN_SCAN_AVX2:
+            return "avx2";
+        case HOEDOWN_SCAN_SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+void
+hoedown_scan_init(hoedown_scan_t *scan, const uint8_t *chars, size_t n,
+                  hoedown_scan_level_t level)
+{
+    hoedown_scan_level_t cpu = hoedown_scan_cpu();
+    int ascii, high = 0, h, c;
+    size_t i;
+
+    memset(scan, 0, sizeof(*scan));
+
+    for (i = 0; i < n; i++) {
+        if (scan->table[chars[i]] == 0) {
+            scan->table[chars[i]] = 1;
+            if (chars[i] & 0x80) {
+                high++;
+            }
+        }
+    }
+
+    /* the bytes above 0x7f are tested by their sign when all are there */
+    scan->high = (high == 128);
+    ascii = (high == 0 || scan->high);
+
+    for (c = 0; c < (scan->high ? 128 : 256); c++) {
+        if (scan->table[c] == 0) {
+            continue;
+        }
+        if (c < 128) {
+            scan->lo[c & 0x0f] |= 1 << (c >> 4);
+        }
+        if (scan->nchars < HOEDOWN_SCAN_SSE2_MAX) {
+            scan->chars[scan->nchars] = (uint8_t)c;
+        }
+        scan->nchars++;
+    }
+
+    for (h = 0; h < 8; h++) {
+        scan->hi[h] = 1 << h;
+    }
+    memcpy(scan->lo + 16, scan->lo, 16);
+    memcpy(scan->hi + 16, scan->hi, 16);
+
+    if (level > cpu) {
+        level = cpu;
+    }
+    if (level == HOEDOWN_SCAN_AVX2 && !ascii) {
+        level = HOEDOWN_SCAN_SSE2;
+    }
+    if (level == HOEDOWN_SCAN_SSE2
+        && scan->nchars > HOEDOWN_SCAN_SSE2_MAX) {
+        level = HOEDOWN_SCAN_SCALAR;
+    }
+
+    scan->level = level;
+    switch (level) {
+#ifdef HOEDOWN_SCAN_X86
+        case HOEDOWN_SCAN_AVX2:
+            scan->find = scan_avx2;
+            break;
+        case HOEDOWN_SCAN_SSE2:
+            scan->find = scan_sse2;
+            break;
+#endif
+        default:
+            scan->level = HOEDOWN_SCAN_SCALAR;
+            scan->find = scan_scalar;
+            break;
+    }
+}
@@ -0,0 +1,59 @@
+/*
+**  hoedown_scan.h -- byte set scanning for mod_hoedown
+**
+**  Finds the next byte of a small set (the active characters of a
+**  parser) in a run of text, 16 or 32 bytes at a time where the cpu
+**  allows it. The kernel is picked when the set is made: AVX2 for sets of
+**  ASCII bytes, SSE2 for sets of up to 6 bytes (one compare per byte of
+**  the set: more is slower than the table), a table lookup otherwise.
+**  Either set may also have all the bytes above 0x7f.
+*/
+
+#ifndef HOEDOWN_SCAN_H
+#define HOEDOWN_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOEDOWN_SCAN_SSE2_MAX 6
+
+typedef enum {
+    HOEDOWN_SCAN_SCALAR = 0,
+    HOEDOWN_SCAN_SSE2,
+    HOEDOWN_SCAN_AVX2
+} hoedown_scan_level_t;
+
+typedef struct hoedown_scan_s hoedown_scan_t;
+
+struct hoedown_scan_s {
+    size_t (*find)(const hoedown_scan_t *scan,
+                   const uint8_t *data, size_t size);
+    hoedown_scan_level_t level;
+    /* nibble tables (AVX2), each repeated for both lanes */
+    uint8_t lo[32];
+    uint8_t hi[32];
+    /* the bytes (SSE2) */
+    uint8_t chars[HOEDOWN_SCAN_SSE2_MAX];
+    int nchars;
+    /* all the bytes above 0x7f are in the set */
+    int high;
+    uint8_t table[256];
+};
+
+/* the best kernel level of this cpu */
+hoedown_scan_level_t hoedown_scan_cpu(void);
+
+char const *hoedown_scan_level_name(hoedown_scan_level_t level);
+
+/*
+ * A set of the n bytes of chars, scanned with the kernel of level, or of
+ * the best level below it the cpu and the set allow.
+ */
+void hoedown_scan_init(hoedown_scan_t *scan, const uint8_t *chars, size_t n,
+                       hoedown_scan_level_t level);
+
+/* offset of the first byte of data in the set, size when there is none */
+#define hoedown_scan_find(_scan, _data, _size) \
+    ((_scan)->find((_scan), (_data), (_size)))
+
+#endif /* HOEDOWN_SCAN_H */
@@ -52,11 +52,49 @@
 **    HoedownRenderEscape        Off
 **    HoedownRenderUseTaskList   Off
 **    HoedownRenderLineContinue  Off
+**    # Render cache (server config)
+**    HoedownCache     shmcb
+**    HoedownCacheSize 1048576
+**    # Render cache options
+**    HoedownCacheTTL          300
+**    HoedownCacheMaxEntrySize 524288
+**    HoedownCompression       Off
+**    HoedownPrerendered       Off
+**    HoedownCoalesceTimeout   0
+**    # Prewarm (server config)
+**    HoedownPrewarm     /var/www/html/index.md
+**    HoedownPrewarmRate 10
+**    # Input options
+**    HoedownMMapThreshold 262144
+**    HoedownMaxNesting    16
+**    HoedownMaxInputSize  0
+**    # Watched markdown trees (server config, inotify)
+**    HoedownWatch /var/www/html
+**    # Stat options
+**    HoedownStatInterval 0
+**    # Large documents
+**    HoedownIncremental       0
+**    HoedownParallelThreshold 0
+**    # Render threads per child (server config)
+**    HoedownParallelThreads 0
+**    # Load options
+**    HoedownRenderBudget 0
+**    # Render slots per child (server config)
+**    HoedownMaxConcurrentRenders 0 1000
+**    # URL options (--with-curl)
+**    HoedownURLTimeout  30
+**    HoedownURLMaxSize  4194304
+**    HoedownURLCacheTTL 60
+**    HoedownURLAllow    example.com .example.org
 **
 **    <Location /hoedown>
 **      # AddHandler hoedown .md
 **      SetHandler hoedown
 **    </Location>
+**
+**    <Location /hoedown-status>
+**      SetHandler hoedown-status
+**    </Location>
 */
 
 /* httpd */
@@ -65,11 +103,21 @@
 #include "http_protocol.h"
 #include "http_main.h"
 #include "http_log.h"
+#include "http_core.h"
+#include "http_request.h"
 #include "util_script.h"
 #include "ap_config.h"
+#include "ap_socache.h"
+#include "ap_provider.h"
+#include "util_mutex.h"
 #include "apr_fnmatch.h"
 #include "apr_strings.h"
 #include "apr_hash.h"
+#include "apr_md5.h"
+#include "apr_atomic.h"
+#include "apr_shm.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_pool.h"
 
 /* apreq2 */
 #include "apreq2/apreq_module_apache2.h"
@@ -85,13 +133,20 @@
 #ifdef HOEDOWN_URL_SUPPORT
 /* libcurl */
 #include "curl/curl.h"
+#include "apr_uri.h"
 #endif
 
 /* hoedown */
-#include "hoedown/src/version.h"
-#include "hoedown/src/document.h"
-#include "hoedown/src/html.h"
-#include "hoedown/src/buffer.h"
+#include "hoedown_render.h"
+#include "hoedown_alloc.h"
+
+#if defined(HAVE_SYS_INOTIFY_H) && APR_HAS_THREADS
+#  define HOEDOWN_WATCH 1
+#  include <poll.h>
+#  include <unistd.h>
+#  include <sys/inotify.h>
+#  include <sys/vfs.h>
+#endif
 
 #ifdef __GNUC__
 #  define UNUSED(x) UNUSED_ ## x __attribute__((__unused__))
@@ -100,486 +155,5047 @@
 #endif
 
 #define HOEDOWN_READ_UNIT       1024
-#define HOEDOWN_OUTPUT_UNIT     64
 #define HOEDOWN_CURL_TIMEOUT    30
-#define HOEDOWN_TITLE_DEFAULT   "Markdown"
-#define HOEDOWN_TITLE_MARKER    "$title"
+#define HOEDOWN_URL_TIMEOUT      30
+#define HOEDOWN_URL_MAX_SIZE     4194304
+#define HOEDOWN_URL_CACHE_TTL    60
+#define HOEDOWN_URL_CACHE_MAX    64
+#define HOEDOWN_URL_MAX_REDIRS   5
+#define HOEDOWN_POST_RESERVE     16777216
+#define HOEDOWN_MAX_INPUT_SIZE   0
 #define HOEDOWN_CONTENT_TYPE    "text/html"
-#define HOEDOWN_TAG             "<body*>"
-#define HOEDOWN_STYLE_EXT       ".html"
-#define HOEDOWN_DIRECTORY_INDEX "index.md"
-#define HOEDOWN_TOC_BEGIN        2
-#define HOEDOWN_TOC_END          6
+#define HOEDOWN_CACHE_ID         "hoedown-cache"
+#define HOEDOWN_CACHE_SIZE       1048576
+#define HOEDOWN_CACHE_TTL        300
+#define HOEDOWN_CACHE_ENTRY_MAX  524288
+#define HOEDOWN_MMAP_THRESHOLD   262144
+#define HOEDOWN_STATS_ID         "hoedown_stats"
+#define HOEDOWN_STATS_BUCKETS    24
+#define HOEDOWN_STATS_LARGEST    8
+#define HOEDOWN_STATS_NAME_MAX   256
+#define HOEDOWN_CONTEXT_MAX      16
+#define HOEDOWN_COALESCE_TIMEOUT 0
+#define HOEDOWN_COALESCE_POLL    10000
+#define HOEDOWN_COALESCE_LOCK    ".lock"
+#define HOEDOWN_INCREMENTAL      0
+#define HOEDOWN_INCREMENTAL_MAX  32
+#define HOEDOWN_INDEX_MAX        64
+#define HOEDOWN_PARALLEL         0
+#define HOEDOWN_PARALLEL_THREADS 0
+#define HOEDOWN_PARALLEL_PARTS   4
+#define HOEDOWN_PREWARM_RATE     10
+#define HOEDOWN_PREWARM_PROGRESS 100
+#define HOEDOWN_PREWARM_POLL     100000
+#define HOEDOWN_STAT_INTERVAL    0
+#define HOEDOWN_STAT_MAX         4096
+#define HOEDOWN_WATCH_POLL       100
+#define HOEDOWN_MAX_RENDERS      0
+#define HOEDOWN_RENDER_QUEUE     1000
+#define HOEDOWN_RENDER_BUDGET    0
+#define HOEDOWN_BUDGET_STEP      65536
+
+module AP_MODULE_DECLARE_DATA hoedown_module;
+
+/* render cache: shared by all children through a socache provider */
+static struct {
+    const ap_socache_provider_t *provider;
+    ap_socache_instance_t *instance;
+    apr_global_mutex_t *mutex;
+    const char *args;
+    apr_size_t size;
+} hoedown_cache = { NULL, NULL, NULL, NULL, HOEDOWN_CACHE_SIZE };
 
 typedef struct {
-    char *default_page;
-    char *directory_index;
-    struct {
-        char *path;
-        char *name;
-        char *ext;
-    } style;
-    struct {
-        char *ul;
-        char *ol;
-        char *task;
-    } class;
+    char const *name;
+    char const *suffix;
+    apr_status_t (*compress)(apr_pool_t *p,
+                             unsigned char const *data, apr_size_t size,
+                             unsigned char **out, apr_size_t *outlen);
+} hoedown_encoding_t;
+
+/* parsed style templates, per child */
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *hash;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} hoedown_styles;
+
+/*
+ * Directories watched with inotify, per child: a change in one of them
+ * bumps its generation, and the stat results of its files are taken
+ * again.
+ */
+typedef struct {
+    char *path;
+    int wd;
+    int tree;
+    apr_uint32_t generation;
+} hoedown_watch_dir_t;
+
+static struct {
+    apr_array_header_t *trees;
+    apr_pool_t *pool;
+    apr_hash_t *dirs;
+    apr_hash_t *wds;
+    int fd;
+    int failed;
+#if APR_HAS_THREADS
+    apr_thread_t *thread;
+#endif
+    volatile apr_uint32_t stop;
+} hoedown_watch = { NULL, NULL, NULL, NULL, -1 };
+
+/* stat results of the markdown and style files, per child */
+typedef struct {
+    char *path;
+    hoedown_watch_dir_t *dir;
+    apr_uint32_t generation;
+    apr_time_t checked;
+    apr_status_t rv;
+    apr_filetype_e filetype;
+    apr_off_t size;
+    apr_time_t mtime;
+} hoedown_finfo_t;
+
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *hash;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} hoedown_finfos;
+
+/*
+ * Renders in progress, per child: requests for a page that is being
+ * rendered wait for it instead of rendering it again.
+ */
+typedef struct {
+    apr_pool_t *pool;
+    char *key;
+#if APR_HAS_THREADS
+    apr_thread_cond_t *cond;
+#endif
+    unsigned char *data;
+    apr_size_t size;
+    int done;
+    int refs;
+} hoedown_flight_t;
+
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *hash;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} hoedown_flights;
+
+/*
+ * Rendered blocks of the documents last rendered block by block, per
+ * child: a block that has not changed since is not rendered again. The
+ * html of a block only depends on its source and the render profile.
+ */
+typedef struct {
+    const uint8_t *html;
+    apr_size_t size;
+} hoedown_rendered_t;
+
+typedef struct {
+    apr_pool_t *pool;
+    char *key;
+    apr_hash_t *blocks;
+    apr_time_t used;
+} hoedown_incremental_t;
+
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *hash;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} hoedown_incrementals;
+
+/* heading index of a document, and its headings alone for the toc */
+typedef struct {
+    apr_pool_t *pool;
+    char *key;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_array_header_t *headings;
+    uint8_t *source;
+    apr_size_t source_size;
+    apr_time_t used;
+} hoedown_index_t;
+
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *hash;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} hoedown_indexes;
+
+/* the render a request leads, released with the request pool */
+typedef struct {
+    request_rec *r;
+    hoedown_flight_t *flight;
+    char *lock;
+} hoedown_coalesce_t;
+
+/* request phases, logged as %{hoedown-<name>-us}n */
+typedef enum {
+    HOEDOWN_PHASE_READ,
+    HOEDOWN_PHASE_FETCH,
+    HOEDOWN_PHASE_STYLE,
+    HOEDOWN_PHASE_TOC,
+    HOEDOWN_PHASE_RENDER,
+    HOEDOWN_PHASE_WRITE,
+    HOEDOWN_PHASE_MAX
+} hoedown_phase_t;
+
+static char const * const hoedown_phases[HOEDOWN_PHASE_MAX] = {
+    "read", "fetch", "style", "toc", "render", "write"
+};
+
+/* per request, in r->request_config */
+typedef struct {
+    apr_interval_time_t phases[HOEDOWN_PHASE_MAX];
+    unsigned int measured;
+    apr_size_t bytes_in;
+    char const *document;
+    char const *cache;
+} hoedown_timing_t;
+
+/*
+ * Aggregates shared by all children. Counters are only ever updated with
+ * atomics: there is no lock on the request path, and a reader may see a
+ * largest document slot while it is being replaced.
+ */
+typedef struct {
+    apr_uint32_t requests;
+    apr_uint32_t renders;
+    apr_uint32_t cache_hits;
+    apr_uint32_t cache_misses;
+    apr_uint32_t sidecar_hits;
+    apr_uint32_t coalesced;
+    apr_uint32_t not_modified;
+    /* bucket i counts durations up to 2^i us, the last one the rest */
+    apr_uint32_t phases[HOEDOWN_PHASE_MAX][HOEDOWN_STATS_BUCKETS];
     struct {
-        int begin;
-        int end;
-        int unescape;
-        char *header;
-        char *footer;
-    } toc;
-    int raw;
-    unsigned int extensions;
-    unsigned int html;
-} hoedown_config_rec;
+        apr_uint32_t size;
+        apr_uint32_t hash;
+        char name[HOEDOWN_STATS_NAME_MAX];
+    } largest[HOEDOWN_STATS_LARGEST];
+    /* a child prewarms the render cache of this generation */
+    apr_uint32_t prewarm;
+} hoedown_stats_t;
 
-module AP_MODULE_DECLARE_DATA hoedown_module;
+static struct {
+    apr_shm_t *shm;
+    hoedown_stats_t *data;
+} hoedown_stats = { NULL, NULL };
 
+/* documents and renderers ready for reuse, per thread and render profile */
+typedef struct {
+    struct {
+        char *profile;
+        hoedown_context_t *ctx;
+    } entries[HOEDOWN_CONTEXT_MAX];
+    int count;
+    int next;
+    int busy;
+    /* render cache entries are retrieved here, then copied at their size */
+    unsigned char *retrieved;
+    apr_size_t retrieved_size;
+} hoedown_contexts_t;
 
-static int
-output_style_header(request_rec *r, apr_file_t *fp, char const *markdown_title)
-{
-    char buf[HUGE_STRING_LEN];
-    char *lower = NULL;
+#if APR_HAS_THREADS
+static apr_threadkey_t *hoedown_contexts_key = NULL;
+#else
+static hoedown_contexts_t *hoedown_contexts = NULL;
+#endif
 
-    while (apr_file_gets(buf, HUGE_STRING_LEN, fp) == APR_SUCCESS) {
-        char *p = strstr(buf, HOEDOWN_TITLE_MARKER);
-        if (!p) {
-            ap_rputs(buf, r);
-        } else {
-            ap_rwrite(buf, p - buf, r);
-            ap_rputs(markdown_title, r);
-            ap_rputs(p + strlen(HOEDOWN_TITLE_MARKER), r);
-        }
+/* render threads for large documents and budgeted renders, per child */
+static struct {
+    int threads;
+#if APR_HAS_THREADS
+    apr_thread_pool_t *pool;
+    /* the renders waited for up to HoedownRenderBudget */
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+    /* of those, the ones still running past it */
+    int overruns;
+#endif
+} hoedown_parallel = { HOEDOWN_PARALLEL_THREADS };
 
-        lower = apr_pstrdup(r->pool, buf);
-        ap_str_tolower(lower);
-        if (apr_fnmatch("*"HOEDOWN_TAG"*", lower, APR_FNM_CASE_BLIND) == 0) {
-            return 1;
-        }
-    }
+/* renders running in a child, bounded by HoedownMaxConcurrentRenders */
+static struct {
+    int max;
+    int timeout;
+    int active;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+#endif
+} hoedown_renders = { HOEDOWN_MAX_RENDERS, HOEDOWN_RENDER_QUEUE };
 
-    return 0;
-}
+/* files rendered into the render cache when a generation starts */
+typedef struct {
+    server_rec *server;
+    char const *pattern;
+    char const *style;
+} hoedown_prewarm_t;
 
-static apr_file_t *
-style_header(request_rec *r, hoedown_config_rec *cfg,
-             char const *style_filename, char const *markdown_filename)
-{
-    apr_status_t rc = -1;
-    apr_file_t *fp = NULL;
-    char *style_filepath = NULL;
-    char *markdown_title;
+static struct {
+    apr_array_header_t *globs;
+    int rate;
+    ap_filter_rec_t *sink;
+#if APR_HAS_THREADS
+    apr_thread_t *thread;
+#endif
+    volatile apr_uint32_t stop;
+} hoedown_prewarm = { NULL, HOEDOWN_PREWARM_RATE };
 
-    if (markdown_filename) {
-        char const *p, *pp, *ps;
-        p = pp = ps = rawmemchr(markdown_filename, '\0');
-        while (ps >= markdown_filename && *ps != '/') {
-            ps--;
-        }
-        if (ps <= markdown_filename) {
-            ps = markdown_filename;
-        } else {
-            ps++;
-        }
-        while (p >= ps && *p != '.') {
-            p--;
-        }
-        if (p < ps) {
-            p = pp;
-        }
-        markdown_title = apr_pstrndup(r->pool, ps, p - ps);
-    } else {
-        markdown_title = HOEDOWN_TITLE_DEFAULT;
-    }
+#ifdef HOEDOWN_URL_SUPPORT
+/* fetched markdown, per child */
+typedef struct {
+    apr_pool_t *pool;
+    char *url;
+    char *data;
+    apr_size_t size;
+    char *etag;
+    char *last_modified;
+    apr_time_t expires;
+} hoedown_url_entry_t;
 
-    if (style_filename == NULL && cfg->style.name != NULL) {
-        style_filename = cfg->style.name;
-    }
+/*
+ * url fetcher, per child: an easy handle per thread keeps its connections
+ * alive, the share adds the dns cache, tls sessions and connections of
+ * all threads.
+ */
+static struct {
+    CURLSH *share;
+    apr_pool_t *pool;
+    apr_hash_t *cache;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+    apr_thread_mutex_t *locks[CURL_LOCK_DATA_LAST];
+    apr_threadkey_t *key;
+#else
+    CURL *curl;
+#endif
+} hoedown_url;
+#endif
 
-    if (style_filename != NULL) {
-        if (cfg->style.path == NULL) {
-            ap_add_common_vars(r);
-            cfg->style.path = (char *)apr_table_get(r->subprocess_env,
-                                                    "DOCUMENT_ROOT");
-        }
 
-        style_filepath = apr_psprintf(r->pool, "%s/%s%s",
-                                      cfg->style.path, style_filename,
-                                      cfg->style.ext);
+/*
+ * Style templates are parsed once per child and shared by all threads:
+ * the header as segments with the $title splice points between them,
+ * and the footer. A template is reloaded when the file's mtime or size
+ * changes; the old one is freed once the last request using it is done.
+ */
+static apr_status_t
+style_release(void *data)
+{
+    hoedown_style_t *style = data;
 
-        rc = apr_file_open(&fp, style_filepath,
-                           APR_READ | APR_BINARY | APR_XTHREAD,
-                           APR_OS_DEFAULT, r->pool);
-        if (rc == APR_SUCCESS) {
-            if (output_style_header(r, fp, markdown_title) != 1) {
-                apr_file_close(fp);
-                fp = NULL;
-            }
-        } else {
-            style_filepath = apr_psprintf(r->pool, "%s/%s%s",
-                                          cfg->style.path,
-                                          cfg->style.name,
-                                          cfg->style.ext);
-
-            rc = apr_file_open(&fp, style_filepath,
-                               APR_READ | APR_BINARY | APR_XTHREAD,
-                               APR_OS_DEFAULT, r->pool);
-            if (rc == APR_SUCCESS) {
-                if (output_style_header(r, fp, markdown_title) != 1) {
-                    apr_file_close(fp);
-                    fp = NULL;
-                }
-            }
-        }
+    if (style->pool == NULL) {
+        return APR_SUCCESS;
     }
 
-    if (rc != APR_SUCCESS) {
-        ap_rputs("<!DOCTYPE html>\n<html>\n", r);
-        ap_rprintf(r, "<head><title>%s</title></head>\n", markdown_title);
-        ap_rputs("<body>\n", r);
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_styles.mutex);
+#endif
+    if (--style->refs == 0 && style->stale) {
+        apr_pool_destroy(style->pool);
     }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_styles.mutex);
+#endif
 
-    return fp;
+    return APR_SUCCESS;
 }
 
-static int
-style_footer(request_rec *r, apr_file_t *fp) {
-    char buf[HUGE_STRING_LEN];
+static hoedown_style_t *
+style_acquire(request_rec *r, char const *filepath, apr_finfo_t *finfo)
+{
+    hoedown_style_t *style, *loaded;
+    apr_pool_t *pool;
 
-    if (fp != NULL) {
-        while (apr_file_gets(buf, HUGE_STRING_LEN, fp) == APR_SUCCESS) {
-            ap_rputs(buf, r);
-        }
-        apr_file_close(fp);
-    } else {
-        ap_rputs("</body>\n</html>\n", r);
+    if (hoedown_styles.hash == NULL) {
+        return hoedown_style_parse(r->pool, filepath, finfo);
     }
 
-    return 0;
-}
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_styles.mutex);
+#endif
+    style = apr_hash_get(hoedown_styles.hash, filepath, APR_HASH_KEY_STRING);
+    if (style && style->mtime == finfo->mtime && style->size == finfo->size) {
+        style->refs++;
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(hoedown_styles.mutex);
+#endif
+        apr_pool_cleanup_register(r->pool, style, style_release,
+                                  apr_pool_cleanup_null);
+        return style;
+    }
+    apr_pool_create(&pool, hoedown_styles.pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_styles.mutex);
+#endif
 
-static void
-append_data(hoedown_buffer *ib, void *buffer, size_t size)
-{
-    size_t offset = 0;
+    /* (re)load outside of the lock */
+    loaded = hoedown_style_parse(pool, filepath, finfo);
 
-    if (!ib || !buffer || size == 0) {
-        return;
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_styles.mutex);
+#endif
+    if (loaded == NULL) {
+        apr_pool_destroy(pool);
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(hoedown_styles.mutex);
+#endif
+        return NULL;
     }
 
-    while (offset < size) {
-        size_t bufsize = ib->asize - ib->size;
-        if (size >= (bufsize + offset)) {
-            memcpy(ib->data + ib->size, buffer + offset, bufsize);
-            ib->size += bufsize;
-            hoedown_buffer_grow(ib, ib->size + HOEDOWN_READ_UNIT);
-            offset += bufsize;
-        } else {
-            bufsize = size - offset;
-            if (bufsize > 0) {
-                memcpy(ib->data + ib->size, buffer + offset, bufsize);
-                ib->size += bufsize;
+    style = apr_hash_get(hoedown_styles.hash, filepath, APR_HASH_KEY_STRING);
+    if (style && style->mtime == loaded->mtime
+        && style->size == loaded->size) {
+        /* another thread got there first */
+        apr_pool_destroy(pool);
+    } else {
+        if (style) {
+            /* drop the entry first: its key lives in the old pool */
+            apr_hash_set(hoedown_styles.hash, filepath,
+                         APR_HASH_KEY_STRING, NULL);
+            style->stale = 1;
+            if (style->refs == 0) {
+                apr_pool_destroy(style->pool);
             }
-            break;
         }
+        loaded->pool = pool;
+        apr_hash_set(hoedown_styles.hash, loaded->filepath,
+                     APR_HASH_KEY_STRING, loaded);
+        style = loaded;
     }
+    style->refs++;
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_styles.mutex);
+#endif
+
+    apr_pool_cleanup_register(r->pool, style, style_release,
+                              apr_pool_cleanup_null);
+
+    return style;
 }
 
-#ifdef HOEDOWN_URL_SUPPORT
-static size_t
-append_url_data(void *buffer, size_t size, size_t nmemb, void *user)
+static void
+finfos_lock(void)
 {
-    size_t segsize = size * nmemb;
-    append_data((hoedown_buffer *)user, buffer, segsize);
-    return segsize;
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_finfos.mutex);
+#endif
 }
+
+static void
+finfos_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_finfos.mutex);
 #endif
+}
 
-static int
-append_page_data(request_rec *r, hoedown_config_rec *cfg,
-                 hoedown_buffer *ib, char *name, int directory)
+/*
+ * Stat a markdown or style file. The result is kept and used again until
+ * its directory changes when it is watched, and for HoedownStatInterval
+ * seconds at most when that is set; without either, the file is stat'ed
+ * every time.
+ */
+static apr_status_t
+stat_file(request_rec *r, hoedown_config_rec *cfg, char const *path,
+          apr_finfo_t *finfo)
 {
-    apr_status_t rc = -1;
-    apr_file_t *fp = NULL;
-    apr_size_t read;
-    char *filename = NULL;
+    hoedown_finfo_t *found;
+    hoedown_watch_dir_t *dir = NULL;
+    apr_uint32_t generation = 0;
+    apr_time_t now;
+    apr_status_t rv;
+    char const *slash;
 
-    if (name == NULL) {
-        if (!cfg->default_page) {
-            return HTTP_NOT_FOUND;
+    if (hoedown_finfos.hash == NULL
+        || (hoedown_watch.dirs == NULL && cfg->stat_interval <= 0)) {
+        return apr_stat(finfo, path, APR_FINFO_MTIME | APR_FINFO_SIZE |
+                        APR_FINFO_TYPE, r->pool);
+    }
+
+    now = apr_time_now();
+
+    finfos_lock();
+
+    if (hoedown_watch.dirs && (slash = strrchr(path, '/')) != NULL) {
+        while (slash > path && slash[-1] == '/') {
+            slash--;
         }
-        filename = cfg->default_page;
-    } else if (strlen(name) <= 0 ||
-               memcmp(name + strlen(name) - 1, "/", 1) == 0) {
-        if (!cfg->directory_index || !directory) {
-            return HTTP_FORBIDDEN;
+        dir = apr_hash_get(hoedown_watch.dirs, path, slash - path);
+        if (dir) {
+            generation = dir->generation;
         }
-        filename = apr_psprintf(r->pool, "%s%s", name, cfg->directory_index);
-    } else {
-        filename = name;
     }
 
-    rc = apr_file_open(&fp, filename,
-                       APR_READ | APR_BINARY | APR_XTHREAD, APR_OS_DEFAULT,
-                       r->pool);
-    if (rc != APR_SUCCESS || !fp) {
-        switch (errno) {
-            case ENOENT:
-                return HTTP_NOT_FOUND;
-            case EACCES:
-                return HTTP_FORBIDDEN;
-            default:
-                break;
-        }
-        return HTTP_INTERNAL_SERVER_ERROR;
+    if (dir == NULL && cfg->stat_interval <= 0) {
+        finfos_unlock();
+        return apr_stat(finfo, path, APR_FINFO_MTIME | APR_FINFO_SIZE |
+                        APR_FINFO_TYPE, r->pool);
+    }
+
+    found = apr_hash_get(hoedown_finfos.hash, path, APR_HASH_KEY_STRING);
+    if (found
+        && found->dir == dir
+        && (dir == NULL || found->generation == generation)
+        && (cfg->stat_interval <= 0
+            || now - found->checked
+               < apr_time_from_sec(cfg->stat_interval))) {
+        memset(finfo, 0, sizeof(apr_finfo_t));
+        finfo->valid = APR_FINFO_MTIME | APR_FINFO_SIZE | APR_FINFO_TYPE;
+        finfo->filetype = found->filetype;
+        finfo->size = found->size;
+        finfo->mtime = found->mtime;
+        rv = found->rv;
+        finfos_unlock();
+        return rv;
     }
 
-    do {
-        rc = apr_file_read_full(fp, ib->data + ib->size, ib->asize - ib->size,
-                                &read);
-        if (read > 0) {
-            ib->size += read;
-            hoedown_buffer_grow(ib, ib->size + HOEDOWN_READ_UNIT);
+    finfos_unlock();
+
+    /* the generation is read before: a change during the stat is seen */
+    rv = apr_stat(finfo, path, APR_FINFO_MTIME | APR_FINFO_SIZE |
+                  APR_FINFO_TYPE, r->pool);
+
+    finfos_lock();
+
+    found = apr_hash_get(hoedown_finfos.hash, path, APR_HASH_KEY_STRING);
+    if (found == NULL) {
+        /* entries are cheap to take again: all go when there are too many */
+        if (apr_hash_count(hoedown_finfos.hash) >= HOEDOWN_STAT_MAX) {
+            apr_pool_clear(hoedown_finfos.pool);
+            hoedown_finfos.hash = apr_hash_make(hoedown_finfos.pool);
         }
-    } while (rc != APR_EOF);
+        found = apr_palloc(hoedown_finfos.pool, sizeof(hoedown_finfo_t));
+        found->path = apr_pstrdup(hoedown_finfos.pool, path);
+        apr_hash_set(hoedown_finfos.hash, found->path, APR_HASH_KEY_STRING,
+                     found);
+    }
+    found->dir = dir;
+    found->generation = generation;
+    found->checked = now;
+    found->rv = rv;
+    found->filetype = rv == APR_SUCCESS ? finfo->filetype : APR_NOFILE;
+    found->size = rv == APR_SUCCESS ? finfo->size : 0;
+    found->mtime = rv == APR_SUCCESS ? finfo->mtime : 0;
 
-    apr_file_close(fp);
+    finfos_unlock();
 
-    return APR_SUCCESS;
+    return rv;
 }
 
-/* content handler */
+#ifdef HOEDOWN_WATCH
+#define HOEDOWN_WATCH_EVENTS                                            \
+    (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF \
+     | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/* network filesystems: inotify does not see the changes of other hosts */
 static int
-hoedown_handler(request_rec *r)
+watch_remote(char const *path)
 {
-    int ret = -1;
-    int directory = 1;
-    apr_file_t *fp = NULL;
-    char *style = NULL;
-    char *url = NULL;
-    char *text = NULL;
-    char *raw = NULL;
-    char *toc = NULL;
-    int toc_begin = HOEDOWN_TOC_BEGIN, toc_end = HOEDOWN_TOC_END;
-    apreq_handle_t *apreq;
-    apr_table_t *params;
+    struct statfs fs;
 
-    hoedown_config_rec *cfg;
+    if (statfs(path, &fs) != 0) {
+        return 0;
+    }
 
-    /* hoedown: markdown */
-    hoedown_buffer *ib, *ob;
-    hoedown_document *markdown;
-    hoedown_renderer *renderer;
-    hoedown_html_renderer_state *state;
+    switch ((unsigned long)fs.f_type) {
+        case 0x6969UL:          /* nfs */
+        case 0x517bUL:          /* smb */
+        case 0xff534d42UL:      /* cifs */
+        case 0xfe534d42UL:      /* smb2 */
+        case 0x65735546UL:      /* fuse */
+        case 0x564cUL:          /* ncp */
+        case 0x73757245UL:      /* coda */
+        case 0x6b414653UL:      /* afs */
+        case 0x47504653UL:      /* gpfs */
+        case 0x0bd00bd0UL:      /* lustre */
+        case 0x00c36400UL:      /* ceph */
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-    if (strcmp(r->handler, "hoedown")) {
-        return DECLINED;
+/* watch a directory, and the ones below it for a tree (under the lock) */
+static void
+watch_add(char *path, int tree, server_rec *s)
+{
+    hoedown_watch_dir_t *dir;
+    apr_dir_t *d;
+    apr_finfo_t finfo;
+    apr_pool_t *p;
+    apr_status_t rv;
+    int wd;
+
+    if (watch_remote(path)) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                     "hoedown: %s is on a network filesystem, not watched: "
+                     "HoedownStatInterval applies to it", path);
+        return;
     }
 
-    if (r->header_only) {
-        return OK;
+    wd = inotify_add_watch(hoedown_watch.fd, path, HOEDOWN_WATCH_EVENTS);
+    if (wd < 0) {
+        /* likely fs.inotify.max_user_watches: once is enough */
+        ap_log_error(APLOG_MARK,
+                     hoedown_watch.failed++ ? APLOG_DEBUG : APLOG_WARNING,
+                     APR_FROM_OS_ERROR(errno), s,
+                     "hoedown: cannot watch %s, HoedownStatInterval "
+                     "applies to it", path);
+        return;
     }
 
-    /* config */
-    cfg = ap_get_module_config(r->per_dir_config, &hoedown_module);
+    dir = apr_hash_get(hoedown_watch.wds, &wd, sizeof(wd));
+    if (dir == NULL) {
+        dir = apr_pcalloc(hoedown_watch.pool, sizeof(hoedown_watch_dir_t));
+        dir->path = path;
+        dir->wd = wd;
+        apr_hash_set(hoedown_watch.wds, &dir->wd, sizeof(dir->wd), dir);
+        apr_hash_set(hoedown_watch.dirs, dir->path, APR_HASH_KEY_STRING,
+                     dir);
+    } else if (dir->tree) {
+        return;
+    }
 
-    /* set contest type */
-    r->content_type = HOEDOWN_CONTENT_TYPE;
+    if (!tree) {
+        return;
+    }
+    dir->tree = 1;
 
-    /* get parameter */
-    apreq = apreq_handle_apache2(r);
-    params = apreq_params(apreq, r->pool);
-    if (params) {
-        style = (char *)apreq_params_as_string(r->pool, params,
-                                               "style", APREQ_JOIN_AS_IS);
-#ifdef HOEDOWN_URL_SUPPORT
-        url = (char *)apreq_params_as_string(r->pool, params,
-                                             "url", APREQ_JOIN_AS_IS);
-#endif
-        if (cfg->raw != 0) {
-            raw = (char *)apr_table_get(params, "raw");
-        }
-        if (cfg->html & HOEDOWN_HTML_TOC) {
-            toc = (char *)apr_table_get(params, "toc");
+    apr_pool_create(&p, hoedown_watch.pool);
+    if (apr_dir_open(&d, path, p) == APR_SUCCESS) {
+        while ((rv = apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE,
+                                  d)) == APR_SUCCESS
+               || rv == APR_INCOMPLETE) {
+            if (finfo.filetype == APR_DIR && strcmp(finfo.name, ".") != 0
+                && strcmp(finfo.name, "..") != 0) {
+                watch_add(apr_pstrcat(hoedown_watch.pool, path, "/",
+                                      finfo.name, NULL), 1, s);
+            }
         }
-        if (r->method_number == M_POST) {
-            text = (char *)apreq_params_as_string(r->pool, params,
-                                                  "markdown", APREQ_JOIN_AS_IS);
+        apr_dir_close(d);
+    }
+    apr_pool_destroy(p);
+}
+
+/* the HoedownStylePath directories of the server config */
+static void
+watch_styles(const ap_directive_t *current, server_rec *s)
+{
+    char const *args;
+    char *path;
+    apr_size_t len;
+
+    for (; current; current = current->next) {
+        if (strcasecmp(current->directive, "HoedownStylePath") == 0) {
+            args = current->args;
+            path = ap_getword_conf(hoedown_watch.pool, &args);
+            len = strlen(path);
+            while (len > 1 && path[len - 1] == '/') {
+                path[--len] = '\0';
+            }
+            if (*path == '/') {
+                watch_add(path, 0, s);
+            }
         }
+        watch_styles(current->first_child, s);
     }
+}
 
-    /* reading everything */
-    ib = hoedown_buffer_new(HOEDOWN_READ_UNIT);
-    hoedown_buffer_grow(ib, HOEDOWN_READ_UNIT);
+/* under the lock */
+static void
+watch_event(const struct inotify_event *event, server_rec *s)
+{
+    hoedown_watch_dir_t *dir;
+    apr_hash_index_t *hi;
 
-    /* page */
-    if (url || text) {
-        directory = 0;
+    /* events were lost: any file may have changed */
+    if (event->mask & IN_Q_OVERFLOW) {
+        for (hi = apr_hash_first(NULL, hoedown_watch.wds); hi;
+             hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&dir);
+            dir->generation++;
+        }
+        return;
     }
-    append_page_data(r, cfg, ib, r->filename, directory);
 
-    /* text */
-    if (text && strlen(text) > 0) {
-        append_data(ib, text, strlen(text));
+    dir = apr_hash_get(hoedown_watch.wds, &event->wd, sizeof(event->wd));
+    if (dir == NULL) {
+        return;
     }
+    dir->generation++;
 
-#ifdef HOEDOWN_URL_SUPPORT
-    /* url */
-    if (url && strlen(url) > 0) {
-        CURL *curl;
+    /* a new directory of a tree */
+    if (dir->tree && event->len > 0 && (event->mask & IN_ISDIR)
+        && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+        watch_add(apr_pstrcat(hoedown_watch.pool, dir->path, "/",
+                              event->name, NULL), 1, s);
+    }
 
-        curl = curl_easy_init();
-        if (!curl) {
-            return HTTP_INTERNAL_SERVER_ERROR;
+    /* the directory is gone; the entries of its files still point to it */
+    if (event->mask & IN_IGNORED) {
+        apr_hash_set(hoedown_watch.wds, &dir->wd, sizeof(dir->wd), NULL);
+        if (apr_hash_get(hoedown_watch.dirs, dir->path,
+                         APR_HASH_KEY_STRING) == dir) {
+            apr_hash_set(hoedown_watch.dirs, dir->path, APR_HASH_KEY_STRING,
+                         NULL);
         }
+    }
+}
 
-        curl_easy_setopt(curl, CURLOPT_URL, url);
+static void * APR_THREAD_FUNC
+watch_thread(apr_thread_t *thread, void *data)
+{
+    server_rec *s = data;
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    struct pollfd pfd;
+    ssize_t len;
+    char *ptr;
 
-        /* curl */
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)ib);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_url_data);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, HOEDOWN_CURL_TIMEOUT);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+    pfd.fd = hoedown_watch.fd;
+    pfd.events = POLLIN;
 
-        ret = curl_easy_perform(curl);
+    while (!apr_atomic_read32(&hoedown_watch.stop)) {
+        if (poll(&pfd, 1, HOEDOWN_WATCH_POLL) <= 0) {
+            continue;
+        }
 
-        curl_easy_cleanup(curl);
+        len = read(hoedown_watch.fd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
 
-        /*
-        if (ret != 0) {
-            hoedown_buffer_free(ib);
-            return HTTP_INTERNAL_SERVER_ERROR;
+        finfos_lock();
+        for (ptr = buf; ptr < buf + len;
+             ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)ptr;
+            watch_event(event, s);
         }
-        */
+        finfos_unlock();
     }
-#endif
 
-    /* default page */
-    if (ib->size == 0) {
-        ret = append_page_data(r, cfg, ib, NULL, 0);
-        if (ret != APR_SUCCESS) {
-            hoedown_buffer_free(ib);
-            return ret;
-        }
+    apr_thread_exit(thread, APR_SUCCESS);
+
+    return NULL;
+}
+
+/* before the pools the thread uses are gone */
+static apr_status_t
+watch_stop(void * UNUSED(data))
+{
+    apr_status_t rv;
+
+    if (hoedown_watch.thread) {
+        apr_atomic_set32(&hoedown_watch.stop, 1);
+        apr_thread_join(&rv, hoedown_watch.thread);
+        hoedown_watch.thread = NULL;
+    }
+    hoedown_watch.dirs = NULL;
+    close(hoedown_watch.fd);
+    hoedown_watch.fd = -1;
+
+    return APR_SUCCESS;
+}
+
+static void
+watch_start(apr_pool_t *p, server_rec *s)
+{
+    char **trees;
+    apr_status_t rv;
+    int i;
+
+    if (hoedown_watch.trees == NULL) {
+        return;
+    }
+
+    hoedown_watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hoedown_watch.fd < 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, APR_FROM_OS_ERROR(errno), s,
+                     "hoedown: inotify is not available, "
+                     "HoedownStatInterval applies");
+        return;
+    }
+
+    apr_pool_create(&hoedown_watch.pool, p);
+    hoedown_watch.wds = apr_hash_make(hoedown_watch.pool);
+    hoedown_watch.dirs = apr_hash_make(hoedown_watch.pool);
+    hoedown_watch.failed = 0;
+    apr_atomic_set32(&hoedown_watch.stop, 0);
+
+    trees = (char **)hoedown_watch.trees->elts;
+    for (i = 0; i < hoedown_watch.trees->nelts; i++) {
+        watch_add(apr_pstrdup(hoedown_watch.pool, trees[i]), 1, s);
+    }
+    watch_styles(ap_conftree, s);
+
+    rv = apr_thread_create(&hoedown_watch.thread, NULL, watch_thread, s, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "hoedown: failed to start the watch thread");
+        hoedown_watch.thread = NULL;
+        watch_stop(NULL);
+        return;
+    }
+    apr_pool_pre_cleanup_register(p, NULL, watch_stop);
+}
+#endif
+
+static char *
+style_filepath(request_rec *r, hoedown_config_rec *cfg, char const *name)
+{
+    char const *path = cfg->style.path;
+
+    if (path == NULL) {
+        path = ap_context_document_root(r);
+    }
+
+    return apr_psprintf(r->pool, "%s/%s%s", path, name, cfg->style.ext);
+}
+
+static char *
+style_resolve(request_rec *r, hoedown_config_rec *cfg,
+              char const *style_filename, apr_finfo_t *finfo)
+{
+    char *filepath;
+
+    if (style_filename == NULL) {
+        style_filename = cfg->style.name;
+    }
+    if (style_filename == NULL) {
+        return NULL;
+    }
+
+    filepath = style_filepath(r, cfg, style_filename);
+    if (stat_file(r, cfg, filepath, finfo) == APR_SUCCESS
+        && finfo->filetype == APR_REG) {
+        return filepath;
+    }
+
+    /* fallback to the default style */
+    if (cfg->style.name == NULL || style_filename == cfg->style.name) {
+        return NULL;
+    }
+
+    filepath = style_filepath(r, cfg, cfg->style.name);
+    if (stat_file(r, cfg, filepath, finfo) == APR_SUCCESS
+        && finfo->filetype == APR_REG) {
+        return filepath;
+    }
+
+    return NULL;
+}
+
+static hoedown_style_t *
+style_header(request_rec *r, hoedown_buffer *ob,
+             char const *style_filepath, apr_finfo_t *style_finfo,
+             char const *markdown_filename)
+{
+    hoedown_style_t *style = NULL;
+
+    if (style_filepath != NULL) {
+        style = style_acquire(r, style_filepath, style_finfo);
+    }
+
+    hoedown_style_header(ob, style,
+                         hoedown_page_title(r->pool, markdown_filename));
+
+    return style;
+}
+
+/*
+ * Per-thread contexts: a render takes the context of its profile, made on
+ * first use. The oldest one goes when the thread has too many.
+ */
+static void
+contexts_destroy(void *data)
+{
+    hoedown_contexts_t *contexts = data;
+    int i;
+
+    if (contexts == NULL) {
+        return;
+    }
+
+    for (i = 0; i < contexts->count; i++) {
+        hoedown_context_free(contexts->entries[i].ctx);
+        free(contexts->entries[i].profile);
+    }
+    free(contexts->retrieved);
+    free(contexts);
+}
+
+static hoedown_contexts_t *
+contexts_get(void)
+{
+    hoedown_contexts_t *contexts = NULL;
+
+#if APR_HAS_THREADS
+    void *data = NULL;
+
+    if (hoedown_contexts_key == NULL) {
+        return NULL;
+    }
+    if (apr_threadkey_private_get(&data, hoedown_contexts_key)
+        == APR_SUCCESS) {
+        contexts = data;
+    }
+#else
+    contexts = hoedown_contexts;
+#endif
+
+    if (contexts == NULL) {
+        contexts = calloc(1, sizeof(hoedown_contexts_t));
+        if (contexts == NULL) {
+            return NULL;
+        }
+#if APR_HAS_THREADS
+        if (apr_threadkey_private_set(contexts, hoedown_contexts_key)
+            != APR_SUCCESS) {
+            free(contexts);
+            return NULL;
+        }
+#else
+        hoedown_contexts = contexts;
+#endif
+    }
+
+    return contexts;
+}
+
+/* the context of a profile (hoedown_context_profile), no pool needed */
+static hoedown_context_t *
+context_take(hoedown_config_rec *cfg, char const *profile,
+             int toc_begin, int toc_end, int toc)
+{
+    hoedown_contexts_t *contexts = contexts_get();
+    hoedown_context_t *ctx;
+    char *copy;
+    int i;
+
+    /* one render at a time per thread */
+    if (contexts == NULL || contexts->busy) {
+        return NULL;
+    }
+
+    for (i = 0; i < contexts->count; i++) {
+        if (strcmp(contexts->entries[i].profile, profile) == 0) {
+            contexts->busy = 1;
+            return contexts->entries[i].ctx;
+        }
+    }
+
+    ctx = hoedown_context_new(cfg, toc_begin, toc_end, toc);
+    if (ctx == NULL) {
+        return NULL;
+    }
+    copy = strdup(profile);
+    if (copy == NULL) {
+        hoedown_context_free(ctx);
+        return NULL;
+    }
+
+    if (contexts->count < HOEDOWN_CONTEXT_MAX) {
+        i = contexts->count++;
+    } else {
+        i = contexts->next;
+        contexts->next = (i + 1) % HOEDOWN_CONTEXT_MAX;
+        hoedown_context_free(contexts->entries[i].ctx);
+        free(contexts->entries[i].profile);
+    }
+    contexts->entries[i].profile = copy;
+    contexts->entries[i].ctx = ctx;
+
+    contexts->busy = 1;
+
+    return ctx;
+}
+
+static hoedown_context_t *
+context_acquire(request_rec *r, hoedown_config_rec *cfg,
+                int toc_begin, int toc_end, int toc)
+{
+    return context_take(cfg,
+                        hoedown_context_profile(r->pool, cfg, toc_begin,
+                                                toc_end, toc),
+                        toc_begin, toc_end, toc);
+}
+
+static void
+context_release(void)
+{
+    hoedown_contexts_t *contexts = contexts_get();
+
+    if (contexts) {
+        contexts->busy = 0;
+    }
+}
+
+/* phase timings of the request, published when it is logged */
+static hoedown_timing_t *
+timing_get(request_rec *r)
+{
+    hoedown_timing_t *timing;
+
+    timing = ap_get_module_config(r->request_config, &hoedown_module);
+    if (timing == NULL) {
+        timing = apr_pcalloc(r->pool, sizeof(hoedown_timing_t));
+        ap_set_module_config(r->request_config, &hoedown_module, timing);
+    }
+
+    return timing;
+}
+
+static void
+timing_add(hoedown_timing_t *timing, hoedown_phase_t phase,
+           apr_interval_time_t elapsed)
+{
+    timing->phases[phase] += elapsed;
+    timing->measured |= 1 << phase;
+}
+
+static void
+append_data(hoedown_buffer *ib, void *buffer, size_t size)
+{
+    if (!ib || !buffer || size == 0) {
+        return;
+    }
+
+    /* geometric, not by unit: appended a piece at a time */
+    if (ib->size + size > ib->asize) {
+        size_t asize = ib->asize * 2;
+
+        if (asize < ib->size + size) {
+            asize = ib->size + size;
+        }
+        hoedown_buffer_grow(ib, asize);
+    }
+    memcpy(ib->data + ib->size, buffer, size);
+    ib->size += size;
+}
+
+/* application/x-www-form-urlencoded body, decoded as it is read */
+typedef struct {
+    apr_pool_t *pool;
+    apr_table_t *params;
+    hoedown_buffer *text;
+    hoedown_buffer *name;
+    hoedown_buffer *value;
+    hoedown_buffer *out;
+    int in_value;
+    int escape;
+    char pending[2];
+} hoedown_form_t;
+
+static apr_status_t
+buffer_cleanup(void *data)
+{
+    hoedown_buffer_free((hoedown_buffer *)data);
+
+    return APR_SUCCESS;
+}
+
+static int
+form_hex(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* a field is complete: the markdown went to text, keep the others */
+static void
+form_field(hoedown_form_t *form)
+{
+    /* a truncated %XX is kept as it is */
+    if (form->escape) {
+        append_data(form->out, "%", 1);
+        append_data(form->out, form->pending, 2 - form->escape);
+        form->escape = 0;
+    }
+
+    if (form->out != form->text && (form->name->size > 0 || form->in_value)) {
+        apr_table_addn(form->params,
+                       apr_pstrmemdup(form->pool, (char *)form->name->data,
+                                      form->name->size),
+                       apr_pstrmemdup(form->pool, (char *)form->value->data,
+                                      form->value->size));
+    }
+
+    form->name->size = 0;
+    form->value->size = 0;
+    form->out = form->name;
+    form->in_value = 0;
+}
+
+static void
+form_decode(hoedown_form_t *form, const char *data, apr_size_t len)
+{
+    const char *end = data + len, *run = data;
+    int c, x;
+
+    while (data < end) {
+        c = (unsigned char)*data;
+
+        if (form->escape) {
+            /* %XX, split anywhere by the buckets */
+            x = form_hex(c);
+            if (x < 0) {
+                append_data(form->out, "%", 1);
+                append_data(form->out, form->pending, 2 - form->escape);
+                form->escape = 0;
+                run = data;
+                continue;
+            }
+            form->pending[2 - form->escape] = (char)c;
+            if (--form->escape == 0) {
+                c = form_hex((unsigned char)form->pending[0]) * 16 + x;
+                hoedown_buffer_putc(form->out, (uint8_t)c);
+            }
+            run = ++data;
+            continue;
+        }
+
+        if (c != '%' && c != '+' && c != '&' && c != '=') {
+            data++;
+            continue;
+        }
+
+        append_data(form->out, (void *)run, data - run);
+
+        if (c == '%') {
+            form->escape = 2;
+        } else if (c == '+') {
+            hoedown_buffer_putc(form->out, ' ');
+        } else if (c == '&') {
+            form_field(form);
+        } else if (form->in_value) {
+            hoedown_buffer_putc(form->out, '=');
+        } else {
+            form->in_value = 1;
+            if (form->name->size == 8
+                && memcmp(form->name->data, "markdown", 8) == 0) {
+                form->out = form->text;
+            } else {
+                form->out = form->value;
+            }
+        }
+
+        run = ++data;
+    }
+
+    append_data(form->out, (void *)run, end - run);
+}
+
+/*
+ * Read a POST body: text/markdown is the markdown itself,
+ * a form has it in the markdown field, decoded here as it is read; the
+ * other form fields are added to params. Nothing is buffered twice and
+ * the body is cut at HoedownMaxInputSize (413). Any other body is left
+ * to apreq.
+ */
+static int
+read_post(request_rec *r, hoedown_config_rec *cfg,
+          const apr_table_t **params, hoedown_buffer *text)
+{
+    apr_bucket_brigade *bb;
+    apr_bucket *b;
+    apr_status_t rv;
+    int ret = OK;
+    apr_off_t total = 0, length = 0;
+    hoedown_form_t form, *decoder = NULL;
+    char const *type, *clen;
+    int seen_eos = 0;
+
+    type = apr_table_get(r->headers_in, "Content-Type");
+    if (type == NULL) {
+        return DECLINED;
+    }
+    if (strncasecmp(type, "application/x-www-form-urlencoded", 33) == 0) {
+        memset(&form, 0, sizeof(form));
+        form.pool = r->pool;
+        form.params = apr_table_make(r->pool, 4);
+        form.text = text;
+        form.name = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+        form.value = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+        form.out = form.name;
+        decoder = &form;
+    } else if (strncasecmp(type, "text/markdown", 13) != 0
+               && strncasecmp(type, "text/x-markdown", 15) != 0) {
+        return DECLINED;
+    }
+
+    /* the whole body at once, when its size is known */
+    clen = apr_table_get(r->headers_in, "Content-Length");
+    if (clen && apr_strtoff(&length, clen, NULL, 10) == APR_SUCCESS
+        && length > 0) {
+        if (cfg->max_input_size > 0 && length > cfg->max_input_size) {
+            ret = HTTP_REQUEST_ENTITY_TOO_LARGE;
+            goto done;
+        }
+        if (length <= HOEDOWN_POST_RESERVE) {
+            hoedown_buffer_grow(text, text->size + (size_t)length);
+        }
+    }
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+    while (!seen_eos) {
+        rv = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                            APR_BLOCK_READ, HUGE_STRING_LEN);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, rv, r,
+                          "hoedown: failed to read request body");
+            ret = ap_map_http_request_error(rv, HTTP_BAD_REQUEST);
+            goto done;
+        }
+
+        for (b = APR_BRIGADE_FIRST(bb); b != APR_BRIGADE_SENTINEL(bb);
+             b = APR_BUCKET_NEXT(b)) {
+            const char *data;
+            apr_size_t len;
+
+            if (APR_BUCKET_IS_EOS(b)) {
+                seen_eos = 1;
+                break;
+            }
+            if (APR_BUCKET_IS_METADATA(b)) {
+                continue;
+            }
+
+            rv = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                ret = HTTP_BAD_REQUEST;
+                goto done;
+            }
+
+            total += len;
+            if (cfg->max_input_size > 0 && total > cfg->max_input_size) {
+                ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                              "hoedown: request body is larger than "
+                              "HoedownMaxInputSize");
+                ret = HTTP_REQUEST_ENTITY_TOO_LARGE;
+                goto done;
+            }
+
+            if (decoder) {
+                form_decode(decoder, data, len);
+            } else {
+                append_data(text, (void *)data, len);
+            }
+        }
+
+        apr_brigade_cleanup(bb);
+    }
+
+    if (decoder) {
+        form_field(decoder);
+        if (*params) {
+            *params = apr_table_overlay(r->pool, *params, form.params);
+        } else {
+            *params = form.params;
+        }
+    }
+
+done:
+    if (decoder) {
+        hoedown_buffer_free(form.name);
+        hoedown_buffer_free(form.value);
+    }
+
+    return ret;
+}
+
+#ifdef HOEDOWN_URL_SUPPORT
+/* response of a url fetch */
+typedef struct {
+    hoedown_buffer *ib;
+    apr_size_t size;
+    apr_size_t max_size;
+    int overflow;
+    apr_pool_t *pool;
+    char *etag;
+    char *last_modified;
+} hoedown_url_fetch_t;
+
+static size_t
+append_url_data(void *buffer, size_t size, size_t nmemb, void *user)
+{
+    hoedown_url_fetch_t *fetch = user;
+    size_t segsize = size * nmemb;
+
+    if (fetch->max_size > 0 && fetch->size + segsize > fetch->max_size) {
+        fetch->overflow = 1;
+        return 0;
+    }
+
+    append_data(fetch->ib, buffer, segsize);
+    fetch->size += segsize;
+
+    return segsize;
+}
+
+static size_t
+append_url_header(char *buffer, size_t size, size_t nmemb, void *user)
+{
+    hoedown_url_fetch_t *fetch = user;
+    size_t len = size * nmemb;
+    char **value = NULL;
+    char *p, *end = buffer + len;
+
+    if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        value = &fetch->etag;
+        p = buffer + 5;
+    } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+        value = &fetch->last_modified;
+        p = buffer + 14;
+    } else {
+        return len;
+    }
+
+    while (p < end && apr_isspace(*p)) {
+        p++;
+    }
+    while (end > p && apr_isspace(*(end - 1))) {
+        end--;
+    }
+    /* headers of a redirect are replaced by the ones that follow */
+    *value = apr_pstrmemdup(fetch->pool, p, end - p);
+
+    return len;
+}
+
+#if APR_HAS_THREADS
+static void
+url_share_lock(CURL * UNUSED(handle), curl_lock_data data,
+               curl_lock_access UNUSED(access), void * UNUSED(user))
+{
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST && hoedown_url.locks[data]) {
+        apr_thread_mutex_lock(hoedown_url.locks[data]);
+    }
+}
+
+static void
+url_share_unlock(CURL * UNUSED(handle), curl_lock_data data,
+                 void * UNUSED(user))
+{
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST && hoedown_url.locks[data]) {
+        apr_thread_mutex_unlock(hoedown_url.locks[data]);
+    }
+}
+
+static void
+url_handle_destroy(void *data)
+{
+    if (data) {
+        curl_easy_cleanup((CURL *)data);
+    }
+}
+#endif
+
+/* the easy handle of this thread, reset for a new transfer */
+static CURL *
+url_handle(void)
+{
+    CURL *curl = NULL;
+
+#if APR_HAS_THREADS
+    void *data = NULL;
+
+    if (hoedown_url.key
+        && apr_threadkey_private_get(&data, hoedown_url.key)
+        == APR_SUCCESS) {
+        curl = data;
+    }
+#else
+    curl = hoedown_url.curl;
+#endif
+
+    if (curl) {
+        /* keeps the connections, dns and tls session caches */
+        curl_easy_reset(curl);
+        return curl;
+    }
+
+    curl = curl_easy_init();
+    if (curl == NULL) {
+        return NULL;
+    }
+
+#if APR_HAS_THREADS
+    if (hoedown_url.key == NULL
+        || apr_threadkey_private_set(curl, hoedown_url.key) != APR_SUCCESS) {
+        /* used once, by the caller */
+        return curl;
+    }
+#else
+    hoedown_url.curl = curl;
+#endif
+
+    return curl;
+}
+
+static void
+url_handle_release(CURL *curl)
+{
+#if APR_HAS_THREADS
+    void *data = NULL;
+
+    if (hoedown_url.key
+        && apr_threadkey_private_get(&data, hoedown_url.key) == APR_SUCCESS
+        && data == curl) {
+        return;
+    }
+    curl_easy_cleanup(curl);
+#else
+    (void)curl;
+#endif
+}
+
+static apr_status_t
+url_destroy(void * UNUSED(data))
+{
+    if (hoedown_url.share) {
+        curl_share_cleanup(hoedown_url.share);
+        hoedown_url.share = NULL;
+    }
+    curl_global_cleanup();
+
+    return APR_SUCCESS;
+}
+
+static void
+url_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+    int i;
+#endif
+
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "hoedown: failed to initialise libcurl");
+        return;
+    }
+    apr_pool_cleanup_register(p, NULL, url_destroy, apr_pool_cleanup_null);
+
+    apr_pool_create(&hoedown_url.pool, p);
+    hoedown_url.cache = apr_hash_make(hoedown_url.pool);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&hoedown_url.mutex, APR_THREAD_MUTEX_DEFAULT, p);
+
+    rv = apr_threadkey_private_create(&hoedown_url.key,
+                                      url_handle_destroy, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "hoedown: failed to create url handle key");
+        hoedown_url.key = NULL;
+    }
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        apr_thread_mutex_create(&hoedown_url.locks[i],
+                                APR_THREAD_MUTEX_DEFAULT, p);
+    }
+#endif
+
+    hoedown_url.share = curl_share_init();
+    if (hoedown_url.share == NULL) {
+        return;
+    }
+#if APR_HAS_THREADS
+    curl_share_setopt(hoedown_url.share, CURLSHOPT_LOCKFUNC, url_share_lock);
+    curl_share_setopt(hoedown_url.share, CURLSHOPT_UNLOCKFUNC,
+                      url_share_unlock);
+#endif
+    curl_share_setopt(hoedown_url.share, CURLSHOPT_SHARE,
+                      CURL_LOCK_DATA_DNS);
+    curl_share_setopt(hoedown_url.share, CURLSHOPT_SHARE,
+                      CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    /* 7.57.0 */
+    curl_share_setopt(hoedown_url.share, CURLSHOPT_SHARE,
+                      CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+/* HoedownURLAllow: host, or .domain for the domain and its subdomains */
+static int
+url_allowed(hoedown_config_rec *cfg, char const *host)
+{
+    char **allow;
+    size_t len, n;
+    int i;
+
+    if (cfg->url.allow == NULL || cfg->url.allow->nelts == 0) {
+        return 1;
+    }
+    if (host == NULL) {
+        return 0;
+    }
+
+    len = strlen(host);
+    allow = (char **)cfg->url.allow->elts;
+    for (i = 0; i < cfg->url.allow->nelts; i++) {
+        if (strcasecmp(allow[i], host) == 0) {
+            return 1;
+        }
+        n = strlen(allow[i]);
+        if (allow[i][0] == '.' && len >= n
+            && strcasecmp(host + len - n, allow[i]) == 0) {
+            return 1;
+        }
+        if (allow[i][0] == '.' && strcasecmp(host, allow[i] + 1) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* a url that may be fetched: http or https, of an allowed host */
+static int
+url_check(request_rec *r, hoedown_config_rec *cfg, char const *url)
+{
+    apr_uri_t uri;
+
+    if (apr_uri_parse(r->pool, url, &uri) != APR_SUCCESS
+        || uri.scheme == NULL
+        || (strcasecmp(uri.scheme, "http") != 0
+            && strcasecmp(uri.scheme, "https") != 0)) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                      "hoedown: invalid url %s", url);
+        return HTTP_BAD_REQUEST;
+    }
+    if (!url_allowed(cfg, uri.hostname)) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                      "hoedown: url host %s is not allowed", uri.hostname);
+        return HTTP_FORBIDDEN;
+    }
+
+    return OK;
+}
+
+static void
+url_cache_lock(void)
+{
+#if APR_HAS_THREADS
+    if (hoedown_url.mutex) {
+        apr_thread_mutex_lock(hoedown_url.mutex);
+    }
+#endif
+}
+
+static void
+url_cache_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (hoedown_url.mutex) {
+        apr_thread_mutex_unlock(hoedown_url.mutex);
+    }
+#endif
+}
+
+/*
+ * Look the url up: a fresh entry is copied to ib (1 is returned), the
+ * validators of a stale one are copied for revalidation (0).
+ */
+static int
+url_cache_get(request_rec *r, char const *url, hoedown_buffer *ib,
+              char **etag, char **last_modified)
+{
+    hoedown_url_entry_t *entry;
+    int fresh = 0;
+
+    if (hoedown_url.cache == NULL) {
+        return 0;
+    }
+
+    url_cache_lock();
+
+    entry = apr_hash_get(hoedown_url.cache, url, APR_HASH_KEY_STRING);
+    if (entry) {
+        if (entry->expires > apr_time_now()) {
+            append_data(ib, entry->data, entry->size);
+            fresh = 1;
+        } else {
+            *etag = entry->etag ? apr_pstrdup(r->pool, entry->etag) : NULL;
+            *last_modified = entry->last_modified
+                ? apr_pstrdup(r->pool, entry->last_modified) : NULL;
+        }
+    }
+
+    url_cache_unlock();
+
+    return fresh;
+}
+
+/* a 304: the stale entry is good for another ttl, copied to ib */
+static int
+url_cache_refresh(char const *url, hoedown_buffer *ib, apr_time_t expires)
+{
+    hoedown_url_entry_t *entry;
+    int found = 0;
+
+    url_cache_lock();
+
+    entry = apr_hash_get(hoedown_url.cache, url, APR_HASH_KEY_STRING);
+    if (entry) {
+        entry->expires = expires;
+        append_data(ib, entry->data, entry->size);
+        found = 1;
+    }
+
+    url_cache_unlock();
+
+    return found;
+}
+
+static void
+url_cache_set(char const *url, hoedown_url_fetch_t *fetch,
+              const uint8_t *data, apr_size_t size, apr_time_t expires)
+{
+    hoedown_url_entry_t *entry, *old, *oldest = NULL;
+    apr_hash_index_t *hi;
+    apr_pool_t *pool;
+
+    if (hoedown_url.cache == NULL) {
+        return;
+    }
+
+    url_cache_lock();
+
+    old = apr_hash_get(hoedown_url.cache, url, APR_HASH_KEY_STRING);
+    if (old) {
+        apr_hash_set(hoedown_url.cache, old->url, APR_HASH_KEY_STRING, NULL);
+        apr_pool_destroy(old->pool);
+    } else if (apr_hash_count(hoedown_url.cache) >= HOEDOWN_URL_CACHE_MAX) {
+        /* the first to expire goes */
+        for (hi = apr_hash_first(NULL, hoedown_url.cache); hi;
+             hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&entry);
+            if (oldest == NULL || entry->expires < oldest->expires) {
+                oldest = entry;
+            }
+        }
+        apr_hash_set(hoedown_url.cache, oldest->url, APR_HASH_KEY_STRING,
+                     NULL);
+        apr_pool_destroy(oldest->pool);
+    }
+
+    if (apr_pool_create(&pool, hoedown_url.pool) == APR_SUCCESS) {
+        entry = apr_palloc(pool, sizeof(hoedown_url_entry_t));
+        entry->pool = pool;
+        entry->url = apr_pstrdup(pool, url);
+        entry->data = apr_pmemdup(pool, data, size);
+        entry->size = size;
+        entry->etag = fetch->etag ? apr_pstrdup(pool, fetch->etag) : NULL;
+        entry->last_modified = fetch->last_modified
+            ? apr_pstrdup(pool, fetch->last_modified) : NULL;
+        entry->expires = expires;
+        apr_hash_set(hoedown_url.cache, entry->url, APR_HASH_KEY_STRING,
+                     entry);
+    }
+
+    url_cache_unlock();
+}
+
+/*
+ * A GET of url into fetch, following redirects up to
+ * HOEDOWN_URL_MAX_REDIRS: each location is checked as the url is, *ret
+ * is its status when it is not allowed.
+ */
+static CURLcode
+url_perform(request_rec *r, hoedown_config_rec *cfg, CURL *curl,
+            char const *url, hoedown_url_fetch_t *fetch, size_t offset,
+            long *status, int *ret)
+{
+    hoedown_buffer *ib = fetch->ib;
+    char const *target = url;
+    char *location;
+    CURLcode rc;
+    int redirs;
+
+    *ret = OK;
+
+    /* a response before this one is dropped */
+    ib->size = offset;
+    fetch->size = 0;
+    fetch->overflow = 0;
+    fetch->etag = NULL;
+    fetch->last_modified = NULL;
+
+    for (redirs = 0; ; redirs++) {
+        curl_easy_setopt(curl, CURLOPT_URL, target);
+
+        rc = curl_easy_perform(curl);
+        *status = 0;
+        if (rc != CURLE_OK) {
+            break;
+        }
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+
+        location = NULL;
+        if (*status < 300 || *status >= 400 || *status == HTTP_NOT_MODIFIED
+            || curl_easy_getinfo(curl, CURLINFO_REDIRECT_URL,
+                                 &location) != CURLE_OK
+            || location == NULL) {
+            break;
+        }
+        if (redirs >= HOEDOWN_URL_MAX_REDIRS) {
+            rc = CURLE_TOO_MANY_REDIRECTS;
+            break;
+        }
+        *ret = url_check(r, cfg, location);
+        if (*ret != OK) {
+            break;
+        }
+        target = apr_pstrdup(r->pool, location);
+
+        /* the body and headers of the redirect are dropped */
+        ib->size = offset;
+        fetch->size = 0;
+        fetch->etag = NULL;
+        fetch->last_modified = NULL;
+    }
+
+    return rc;
+}
+
+/*
+ * Fetch the markdown of the url parameter into ib: from the cache while
+ * it is fresh, revalidated with its ETag/Last-Modified once it is stale.
+ * Redirects are followed here, each location checked as the url is. A
+ * 304 for an entry evicted meanwhile is fetched again without them. A
+ * failed fetch adds nothing.
+ */
+static int
+url_fetch(request_rec *r, hoedown_config_rec *cfg, char const *url,
+          hoedown_buffer *ib)
+{
+    hoedown_url_fetch_t fetch;
+    struct curl_slist *headers = NULL;
+    CURL *curl;
+    CURLcode rc;
+    long status = 0;
+    char *etag = NULL, *last_modified = NULL;
+    size_t offset = ib->size;
+    apr_time_t expires;
+    int ret, refreshed = 0;
+
+    ret = url_check(r, cfg, url);
+    if (ret != OK) {
+        return ret;
+    }
+
+    if (cfg->url.cache_ttl > 0
+        && url_cache_get(r, url, ib, &etag, &last_modified)) {
+        return OK;
+    }
+
+    curl = url_handle();
+    if (curl == NULL) {
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.ib = ib;
+    fetch.max_size = cfg->url.max_size > 0 ? (apr_size_t)cfg->url.max_size : 0;
+    if (cfg->max_input_size > 0
+        && (fetch.max_size == 0
+            || (apr_size_t)cfg->max_input_size < fetch.max_size)) {
+        fetch.max_size = (apr_size_t)cfg->max_input_size;
+    }
+    fetch.pool = r->pool;
+
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&fetch);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_url_data);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&fetch);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, append_url_header);
+    /* a redirect may point at a host that is not allowed */
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 0L);
+    curl_easy_setopt(curl, CURLOPT_PROTOCOLS,
+                     (long)(CURLPROTO_HTTP | CURLPROTO_HTTPS));
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT,
+                     (long)HOEDOWN_CURL_TIMEOUT);
+    if (cfg->url.timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)cfg->url.timeout);
+    }
+    if (fetch.max_size > 0) {
+        curl_easy_setopt(curl, CURLOPT_MAXFILESIZE, (long)fetch.max_size);
+    }
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    if (hoedown_url.share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, hoedown_url.share);
+    }
+
+    /* revalidate the stale entry */
+    if (etag) {
+        headers = curl_slist_append(headers,
+                                    apr_pstrcat(r->pool, "If-None-Match: ",
+                                                etag, NULL));
+    }
+    if (last_modified) {
+        headers = curl_slist_append(headers,
+                                    apr_pstrcat(r->pool,
+                                                "If-Modified-Since: ",
+                                                last_modified, NULL));
+    }
+    if (headers) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+
+    expires = apr_time_now() + apr_time_from_sec(cfg->url.cache_ttl);
+
+    rc = url_perform(r, cfg, curl, url, &fetch, offset, &status, &ret);
+
+    /* a 304 for an entry gone since: again, unconditionally */
+    if (rc == CURLE_OK && ret == OK && status == HTTP_NOT_MODIFIED) {
+        refreshed = url_cache_refresh(url, ib, expires);
+        if (!refreshed && headers) {
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+            rc = url_perform(r, cfg, curl, url, &fetch, offset, &status,
+                             &ret);
+        }
+    }
+
+    /* the handle must not keep pointers to this request */
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(headers);
+    url_handle_release(curl);
+
+    if (ret != OK) {
+        ib->size = offset;
+        return ret;
+    }
+
+    if (refreshed) {
+        return OK;
+    }
+
+    if (rc != CURLE_OK || status < 200 || status >= 300) {
+        ib->size = offset;
+        if (fetch.overflow || rc == CURLE_FILESIZE_EXCEEDED) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                          "hoedown: %s is larger than HoedownURLMaxSize "
+                          "or HoedownMaxInputSize", url);
+        } else {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                          "hoedown: failed to fetch %s: %s (%ld)", url,
+                          rc != CURLE_OK ? curl_easy_strerror(rc)
+                          : "unexpected status", status);
+        }
+        return OK;
+    }
+
+    if (cfg->url.cache_ttl > 0) {
+        url_cache_set(url, &fetch, ib->data + offset, ib->size - offset,
+                      expires);
+    }
+
+    return OK;
+}
+#endif
+
+static int
+page_filename(request_rec *r, hoedown_config_rec *cfg,
+              char *name, int directory, char **filename)
+{
+    if (name == NULL) {
+        if (!cfg->default_page) {
+            return HTTP_NOT_FOUND;
+        }
+        *filename = cfg->default_page;
+    } else if (strlen(name) <= 0 ||
+               memcmp(name + strlen(name) - 1, "/", 1) == 0) {
+        if (!cfg->directory_index || !directory) {
+            return HTTP_FORBIDDEN;
+        }
+        *filename = apr_psprintf(r->pool, "%s%s", name, cfg->directory_index);
+    } else {
+        *filename = name;
+    }
+
+    return APR_SUCCESS;
+}
+
+/* status of a page file that cannot be opened */
+static int
+file_status(apr_status_t rv)
+{
+    if (APR_STATUS_IS_ENOENT(rv) || APR_STATUS_IS_ENOTDIR(rv)) {
+        return HTTP_NOT_FOUND;
+    }
+    if (APR_STATUS_IS_EACCES(rv)) {
+        return HTTP_FORBIDDEN;
+    }
+    return HTTP_INTERNAL_SERVER_ERROR;
+}
+
+/*
+ * Load a markdown file. The file size is known up front, so the input
+ * buffer is grown once; files of HoedownMMapThreshold bytes or more are
+ * mapped instead when the caller can take the mapping (mm != NULL) and
+ * nothing has been read yet.
+ */
+static int
+append_page_data(request_rec *r, hoedown_config_rec *cfg,
+                 hoedown_buffer *ib, char *name, int directory,
+                 apr_mmap_t **mm)
+{
+    apr_status_t rc = -1;
+    apr_file_t *fp = NULL;
+    apr_finfo_t finfo;
+    apr_size_t read = 0;
+    apr_off_t size;
+    char *filename = NULL;
+
+    rc = page_filename(r, cfg, name, directory, &filename);
+    if (rc != APR_SUCCESS) {
+        return rc;
+    }
+
+    /* the request file: the directory walk stat'ed it */
+    if (filename == r->filename) {
+        if (r->finfo.filetype == APR_NOFILE) {
+            return HTTP_NOT_FOUND;
+        }
+        if (r->finfo.filetype != APR_REG) {
+            return HTTP_FORBIDDEN;
+        }
+    }
+
+    rc = apr_file_open(&fp, filename,
+                       APR_READ | APR_BINARY | APR_XTHREAD, APR_OS_DEFAULT,
+                       r->pool);
+    if (rc != APR_SUCCESS) {
+        return file_status(rc);
+    }
+
+    if (filename == r->filename && r->finfo.filetype == APR_REG) {
+        size = r->finfo.size;
+    } else if (apr_file_info_get(&finfo, APR_FINFO_SIZE,
+                                 fp) == APR_SUCCESS) {
+        size = finfo.size;
+    } else {
+        apr_file_close(fp);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (size <= 0) {
+        apr_file_close(fp);
+        return APR_SUCCESS;
+    }
+
+#if APR_HAS_MMAP
+    if (mm && ib->size == 0 && cfg->mmap_threshold > 0
+        && size >= cfg->mmap_threshold) {
+        /* the mapping (and the file) live until the request pool goes */
+        rc = apr_mmap_create(mm, fp, 0, (apr_size_t)size, APR_MMAP_READ,
+                             r->pool);
+        if (rc == APR_SUCCESS) {
+            return APR_SUCCESS;
+        }
+        *mm = NULL;
+    }
+#endif
+
+    hoedown_buffer_grow(ib, ib->size + (size_t)size);
+
+    rc = apr_file_read_full(fp, ib->data + ib->size, (apr_size_t)size, &read);
+    ib->size += read;
+
+    apr_file_close(fp);
+
+    if (rc != APR_SUCCESS && rc != APR_EOF) {
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Stat the markdown file that a local page render would read: the request
+ * file (or its directory index), else the default page. Mirrors the
+ * fallback order of the handler. The request file was stat'ed by the
+ * directory walk already.
+ */
+static char *
+page_stat(request_rec *r, hoedown_config_rec *cfg, apr_finfo_t *finfo)
+{
+    char *filename = NULL;
+    apr_status_t rv;
+
+    if (page_filename(r, cfg, r->filename, 1, &filename) == APR_SUCCESS) {
+        if (filename == r->filename && r->finfo.filetype != APR_NOFILE) {
+            *finfo = r->finfo;
+            rv = APR_SUCCESS;
+        } else {
+            rv = stat_file(r, cfg, filename, finfo);
+        }
+        if (rv == APR_SUCCESS && finfo->filetype == APR_REG
+            && finfo->size > 0) {
+            return filename;
+        }
+    }
+
+    if (page_filename(r, cfg, NULL, 0, &filename) == APR_SUCCESS
+        && stat_file(r, cfg, filename, finfo) == APR_SUCCESS
+        && finfo->filetype == APR_REG) {
+        return filename;
+    }
+
+    return NULL;
+}
+
+/* content codings in order of preference */
+static const hoedown_encoding_t hoedown_encodings[] = {
+#ifdef HAVE_BROTLI
+    { "br", ".br", hoedown_compress_brotli },
+#endif
+#ifdef HAVE_ZLIB
+    { "gzip", ".gz", hoedown_compress_gzip },
+#endif
+    { NULL, NULL, NULL }
+};
+
+static int
+accept_encoding(request_rec *r, char const *accept, char const *name)
+{
+    char *tokens, *token, *last;
+
+    tokens = apr_pstrdup(r->pool, accept);
+    for (token = apr_strtok(tokens, ",", &last); token;
+         token = apr_strtok(NULL, ",", &last)) {
+        char *q;
+        size_t len;
+
+        while (apr_isspace(*token)) {
+            token++;
+        }
+        len = strcspn(token, "; \t");
+        if (len != strlen(name) || strncasecmp(token, name, len) != 0) {
+            continue;
+        }
+
+        /* q=0 means not acceptable */
+        q = strstr(token + len, "q=");
+        if (q && atof(q + 2) <= 0) {
+            return 0;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+static const hoedown_encoding_t *
+negotiate_encoding(request_rec *r)
+{
+    const hoedown_encoding_t *encoding;
+    char const *accept;
+
+    accept = apr_table_get(r->headers_in, "Accept-Encoding");
+    if (accept == NULL) {
+        return NULL;
+    }
+
+    for (encoding = hoedown_encodings; encoding->name; encoding++) {
+        if (accept_encoding(r, accept, encoding->name)) {
+            return encoding;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Fingerprint of a local page render: used as the cache key and the ETag.
+ */
+static int
+page_validate(request_rec *r, char const *fingerprint,
+              const hoedown_encoding_t *encoding,
+              apr_finfo_t *finfo, apr_finfo_t *style_finfo)
+{
+    if (r->method_number != M_GET) {
+        return OK;
+    }
+
+    ap_update_mtime(r, finfo->mtime);
+    if (style_finfo) {
+        ap_update_mtime(r, style_finfo->mtime);
+    }
+    ap_set_last_modified(r);
+
+    if (encoding) {
+        apr_table_setn(r->headers_out, "ETag",
+                       apr_psprintf(r->pool, "\"%s-%s\"",
+                                    fingerprint, encoding->name));
+    } else {
+        apr_table_setn(r->headers_out, "ETag",
+                       apr_psprintf(r->pool, "\"%s\"", fingerprint));
+    }
+
+    return ap_meets_conditions(r);
+}
+
+/*
+ * The provider needs room for the largest entry: that is the buffer of
+ * the thread, and the request only gets a copy of the entry found.
+ */
+static apr_status_t
+cache_retrieve(request_rec *r, hoedown_config_rec *cfg, char const *key,
+               unsigned char **data, unsigned int *size)
+{
+    hoedown_contexts_t *contexts = contexts_get();
+    unsigned char *buffer = NULL, *grown;
+    apr_status_t rv;
+
+    *size = cfg->cache.max_entry;
+
+    if (contexts && contexts->retrieved_size < *size) {
+        grown = realloc(contexts->retrieved, *size);
+        if (grown) {
+            contexts->retrieved = grown;
+            contexts->retrieved_size = *size;
+        }
+    }
+    if (contexts && contexts->retrieved_size >= *size) {
+        buffer = contexts->retrieved;
+        *data = buffer;
+    } else {
+        *data = apr_palloc(r->pool, *size);
+    }
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_lock(hoedown_cache.mutex);
+    }
+
+    rv = hoedown_cache.provider->retrieve(hoedown_cache.instance, r->server,
+                                          (unsigned char *)key, strlen(key),
+                                          *data, size, r->pool);
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_unlock(hoedown_cache.mutex);
+    }
+
+    if (buffer) {
+        *data = rv == APR_SUCCESS ? apr_pmemdup(r->pool, buffer, *size)
+            : NULL;
+    }
+
+    return rv;
+}
+
+static apr_status_t
+cache_store(request_rec *r, hoedown_config_rec *cfg, char const *key,
+            unsigned char *data, apr_size_t size)
+{
+    apr_status_t rv;
+    apr_time_t expiry;
+
+    if (size > (apr_size_t)cfg->cache.max_entry) {
+        return APR_ENOSPC;
+    }
+
+    expiry = r->request_time + apr_time_from_sec(cfg->cache.ttl);
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_lock(hoedown_cache.mutex);
+    }
+
+    rv = hoedown_cache.provider->store(hoedown_cache.instance, r->server,
+                                       (unsigned char *)key, strlen(key),
+                                       expiry, data, size, r->pool);
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_unlock(hoedown_cache.mutex);
+    }
+
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
+                      "hoedown: failed to cache %s", r->filename);
+    }
+
+    return rv;
+}
+
+/* lock marker of a page render in the shared cache */
+static int
+cache_locked(request_rec *r, char const *lock)
+{
+    unsigned char data[1];
+    unsigned int size = sizeof(data);
+    apr_status_t rv;
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_lock(hoedown_cache.mutex);
+    }
+
+    rv = hoedown_cache.provider->retrieve(hoedown_cache.instance, r->server,
+                                          (unsigned char *)lock, strlen(lock),
+                                          data, &size, r->pool);
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_unlock(hoedown_cache.mutex);
+    }
+
+    return rv == APR_SUCCESS;
+}
+
+/*
+ * Set the lock marker unless another child holds it, returns 1 when this
+ * child leads. The check and the set are one step under the cache mutex,
+ * whatever the provider, so that only one child leads.
+ */
+static int
+cache_lock(request_rec *r, char const *lock, apr_time_t expiry)
+{
+    unsigned char data[1] = { '1' };
+    unsigned int size = sizeof(data);
+    int locked = 0;
+
+    apr_global_mutex_lock(hoedown_cache.mutex);
+
+    if (hoedown_cache.provider->retrieve(hoedown_cache.instance, r->server,
+                                         (unsigned char *)lock, strlen(lock),
+                                         data, &size, r->pool)
+        != APR_SUCCESS) {
+        data[0] = '1';
+        hoedown_cache.provider->store(hoedown_cache.instance, r->server,
+                                      (unsigned char *)lock, strlen(lock),
+                                      expiry, data, sizeof(data), r->pool);
+        locked = 1;
+    }
+
+    apr_global_mutex_unlock(hoedown_cache.mutex);
+
+    return locked;
+}
+
+static void
+cache_unlock(request_rec *r, char const *lock)
+{
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_lock(hoedown_cache.mutex);
+    }
+
+    hoedown_cache.provider->remove(hoedown_cache.instance, r->server,
+                                   (unsigned char *)lock, strlen(lock),
+                                   r->pool);
+
+    if (hoedown_cache.provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        apr_global_mutex_unlock(hoedown_cache.mutex);
+    }
+}
+
+static void
+flight_lock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_flights.mutex);
+#endif
+}
+
+static void
+flight_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_flights.mutex);
+#endif
+}
+
+/* drop a reference, with the flights locked */
+static void
+flight_release(hoedown_flight_t *flight)
+{
+    if (--flight->refs > 0) {
+        return;
+    }
+
+    if (flight->data) {
+        free(flight->data);
+    }
+    apr_pool_destroy(flight->pool);
+}
+
+/*
+ * Publish the page of the render a request leads (NULL when it did not
+ * get that far) and wake the requests waiting for it.
+ */
+static void
+flight_finish(hoedown_coalesce_t *coalesce,
+              unsigned char const *data, apr_size_t size)
+{
+    hoedown_flight_t *flight = coalesce->flight;
+
+    if (coalesce->lock) {
+        cache_unlock(coalesce->r, coalesce->lock);
+        coalesce->lock = NULL;
+    }
+
+    if (flight == NULL) {
+        return;
+    }
+    coalesce->flight = NULL;
+
+    flight_lock();
+
+    if (data) {
+        /* outlives the request */
+        flight->data = malloc(size ? size : 1);
+        if (flight->data) {
+            memcpy(flight->data, data, size);
+            flight->size = size;
+        }
+    }
+    flight->done = 1;
+    apr_hash_set(hoedown_flights.hash, flight->key, APR_HASH_KEY_STRING,
+                 NULL);
+#if APR_HAS_THREADS
+    apr_thread_cond_broadcast(flight->cond);
+#endif
+    flight_release(flight);
+
+    flight_unlock();
+}
+
+static apr_status_t
+flight_cleanup(void *data)
+{
+    flight_finish((hoedown_coalesce_t *)data, NULL, 0);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Wait for a render of the same page (key: file, mtime, style and render
+ * profile) that is already in progress, in this child or, through a lock
+ * marker in the shared cache, in another one. Returns 1 with its page,
+ * else 0: the caller renders the page, and leads the render when
+ * *coalesce is set. Waiting is bounded by HoedownCoalesceTimeout.
+ */
+static int
+flight_join(request_rec *r, hoedown_config_rec *cfg, char const *fingerprint,
+            char const *key, hoedown_coalesce_t **coalesce,
+            unsigned char **data, apr_size_t *size)
+{
+    hoedown_flight_t *flight;
+    apr_time_t deadline;
+    apr_pool_t *pool;
+    unsigned int cached_size;
+    int found = 0;
+
+    *coalesce = NULL;
+
+    if (hoedown_flights.hash == NULL) {
+        return 0;
+    }
+
+    deadline = apr_time_now() + apr_time_from_msec(cfg->coalesce);
+
+    flight_lock();
+
+    flight = apr_hash_get(hoedown_flights.hash, fingerprint,
+                          APR_HASH_KEY_STRING);
+    if (flight) {
+        flight->refs++;
+#if APR_HAS_THREADS
+        while (!flight->done) {
+            apr_time_t now = apr_time_now();
+
+            if (now >= deadline) {
+                break;
+            }
+            apr_thread_cond_timedwait(flight->cond, hoedown_flights.mutex,
+                                      deadline - now);
+        }
+#endif
+        if (flight->done && flight->data) {
+            *data = apr_pmemdup(r->pool, flight->data, flight->size);
+            *size = flight->size;
+            found = 1;
+        }
+        flight_release(flight);
+
+        flight_unlock();
+
+        /* a slow or failed leader: render it here */
+        return found;
+    }
+
+    /* leading the render in this child */
+    if (apr_pool_create(&pool, hoedown_flights.pool) == APR_SUCCESS) {
+        flight = apr_pcalloc(pool, sizeof(hoedown_flight_t));
+        flight->pool = pool;
+        flight->key = apr_pstrdup(pool, fingerprint);
+        flight->refs = 1;
+#if APR_HAS_THREADS
+        if (apr_thread_cond_create(&flight->cond, pool) != APR_SUCCESS) {
+            apr_pool_destroy(pool);
+            flight = NULL;
+        }
+#endif
+    } else {
+        flight = NULL;
+    }
+    if (flight) {
+        apr_hash_set(hoedown_flights.hash, flight->key, APR_HASH_KEY_STRING,
+                     flight);
+    }
+
+    flight_unlock();
+
+    *coalesce = apr_pcalloc(r->pool, sizeof(hoedown_coalesce_t));
+    (*coalesce)->r = r;
+    (*coalesce)->flight = flight;
+    apr_pool_cleanup_register(r->pool, *coalesce, flight_cleanup,
+                              apr_pool_cleanup_null);
+
+    /* other children: through the shared cache */
+    if (key == NULL) {
+        return 0;
+    }
+
+    (*coalesce)->lock = apr_pstrcat(r->pool, key, HOEDOWN_COALESCE_LOCK,
+                                    NULL);
+    if (cache_lock(r, (*coalesce)->lock, deadline)) {
+        return 0;
+    }
+
+    /* not ours to remove */
+    (*coalesce)->lock = NULL;
+
+    while (apr_time_now() < deadline) {
+        apr_sleep(HOEDOWN_COALESCE_POLL);
+        if (cache_locked(r, apr_pstrcat(r->pool, key, HOEDOWN_COALESCE_LOCK,
+                                        NULL))) {
+            continue;
+        }
+        if (cache_retrieve(r, cfg, key, data, &cached_size) == APR_SUCCESS) {
+            *size = cached_size;
+            /* the waiters in this child get it as well */
+            flight_finish(*coalesce, *data, *size);
+            return 1;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * Write a rendered page, compressed with the negotiated content coding
+ * when there is one. The compressed variant is cached next to the page.
+ */
+static void
+output_page(request_rec *r, hoedown_config_rec *cfg, char const *key,
+            const hoedown_encoding_t *encoding,
+            unsigned char *data, apr_size_t size)
+{
+    apr_time_t start;
+
+    if (encoding) {
+        unsigned char *out;
+        apr_size_t outlen;
+
+        if (encoding->compress(r->pool, data, size,
+                               &out, &outlen) == APR_SUCCESS) {
+            if (key) {
+                cache_store(r, cfg,
+                            apr_pstrcat(r->pool, key, encoding->suffix, NULL),
+                            out, outlen);
+            }
+            apr_table_setn(r->headers_out, "Content-Encoding",
+                           encoding->name);
+            data = out;
+            size = outlen;
+        } else {
+            char const *etag = apr_table_get(r->headers_out, "ETag");
+            char *suffix = apr_psprintf(r->pool, "-%s\"", encoding->name);
+            apr_size_t len = etag ? strlen(etag) : 0, n = strlen(suffix);
+
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                          "hoedown: failed to %s compress %s",
+                          encoding->name, r->filename);
+
+            /* the ETag of the identity page (page_validate) */
+            if (len > n && strcmp(etag + len - n, suffix) == 0) {
+                apr_table_setn(r->headers_out, "ETag",
+                               apr_pstrcat(r->pool,
+                                           apr_pstrmemdup(r->pool, etag,
+                                                          len - n),
+                                           "\"", NULL));
+            }
+        }
+    }
+
+    ap_set_content_length(r, size);
+
+    start = apr_time_now();
+    ap_rwrite(data, size, r);
+    timing_add(timing_get(r), HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+}
+
+/*
+ * Streamed output, used when the page is neither cached nor compressed:
+ * the header is flushed ahead of the render, rendered buffers are handed
+ * to the brigade without a copy and the footer is sent from the file.
+ */
+static void
+output_buffer(apr_bucket_brigade *bb, hoedown_buffer *ob)
+{
+    apr_bucket *b;
+
+    if (ob->size == 0) {
+        return;
+    }
+
+    b = apr_bucket_heap_create((char *)ob->data, ob->size, ob->data_free,
+                               bb->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(bb, b);
+
+    /*
+     * the bucket owns the data now; arena data is only released with the
+     * request pool, which outlives the brigade
+     */
+    ob->data = NULL;
+    ob->size = 0;
+    ob->asize = 0;
+}
+
+static void
+output_footer(request_rec *r, apr_bucket_brigade *bb, hoedown_style_t *style)
+{
+    apr_file_t *fp = NULL;
+    apr_finfo_t finfo;
+    apr_bucket *b;
+
+    if (style == NULL || !style->body) {
+        b = apr_bucket_immortal_create("</body>\n</html>\n",
+                                       sizeof("</body>\n</html>\n") - 1,
+                                       bb->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, b);
+        return;
+    }
+
+    if (style->footer_len == 0) {
+        return;
+    }
+
+    /* file bucket, as long as the file is still the parsed one */
+    if (apr_file_open(&fp, style->filepath,
+                      APR_READ | APR_BINARY | APR_SENDFILE_ENABLED,
+                      APR_OS_DEFAULT, r->pool) == APR_SUCCESS) {
+        if (apr_file_info_get(&finfo, APR_FINFO_MTIME | APR_FINFO_SIZE,
+                              fp) == APR_SUCCESS
+            && finfo.mtime == style->mtime && finfo.size == style->size) {
+            apr_brigade_insert_file(bb, fp, style->footer_offset,
+                                    style->footer_len, r->pool);
+            return;
+        }
+        apr_file_close(fp);
+    }
+
+    b = apr_bucket_heap_create(style->footer, style->footer_len, NULL,
+                               bb->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(bb, b);
+}
+
+/*
+ * Pre-rendered pages written by hoedown-prerender next to the markdown
+ * file: used as long as the fingerprint on their first line is the one
+ * of the page that would be rendered now.
+ */
+static apr_file_t *
+sidecar_match(request_rec *r, char const *path,
+              char const *header, apr_size_t len, apr_off_t *length)
+{
+    apr_file_t *fp = NULL;
+    apr_finfo_t finfo;
+    apr_size_t read = 0;
+    char *buf;
+
+    if (apr_file_open(&fp, path,
+                      APR_READ | APR_BINARY | APR_SENDFILE_ENABLED,
+                      APR_OS_DEFAULT, r->pool) != APR_SUCCESS) {
+        return NULL;
+    }
+
+    buf = apr_palloc(r->pool, len);
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fp) == APR_SUCCESS
+        && finfo.size >= (apr_off_t)len
+        && apr_file_read_full(fp, buf, len, &read) == APR_SUCCESS
+        && memcmp(buf, header, len) == 0) {
+        *length = finfo.size - len;
+        return fp;
+    }
+
+    apr_file_close(fp);
+
+    return NULL;
+}
+
+static apr_file_t *
+sidecar_open(request_rec *r, hoedown_config_rec *cfg, char const *filename,
+             char const *fingerprint, const hoedown_encoding_t **encoding,
+             apr_off_t *offset, apr_off_t *length)
+{
+    char const *header = hoedown_sidecar_header(r->pool, fingerprint);
+    apr_file_t *fp;
+
+    *offset = strlen(header);
+
+#ifdef HAVE_ZLIB
+    if (cfg->compression) {
+        char const *accept = apr_table_get(r->headers_in, "Accept-Encoding");
+        const hoedown_encoding_t *e;
+
+        for (e = hoedown_encodings; e->name; e++) {
+            if (strcmp(e->name, "gzip") == 0) {
+                break;
+            }
+        }
+
+        if (accept && e->name && accept_encoding(r, accept, e->name)) {
+            fp = sidecar_match(r,
+                               apr_pstrcat(r->pool, filename,
+                                           HOEDOWN_SIDECAR_GZIP_EXT, NULL),
+                               header, *offset, length);
+            if (fp) {
+                *encoding = e;
+                return fp;
+            }
+        }
+    }
+#endif
+
+    fp = sidecar_match(r,
+                       apr_pstrcat(r->pool, filename, HOEDOWN_SIDECAR_EXT,
+                                   NULL),
+                       header, *offset, length);
+
+    return fp;
+}
+
+static void
+incremental_lock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_incrementals.mutex);
+#endif
+}
+
+static void
+incremental_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_incrementals.mutex);
+#endif
+}
+
+static void
+index_lock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_indexes.mutex);
+#endif
+}
+
+static void
+index_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(hoedown_indexes.mutex);
+#endif
+}
+
+/* a copy of an index, for the request */
+static hoedown_index_t *
+index_copy(apr_pool_t *p, hoedown_index_t *index)
+{
+    hoedown_index_t *copy = apr_pmemdup(p, index, sizeof(hoedown_index_t));
+    hoedown_heading_t *heading;
+    int i;
+
+    copy->pool = p;
+    copy->headings = apr_array_copy(p, index->headings);
+    heading = (hoedown_heading_t *)copy->headings->elts;
+    for (i = 0; i < copy->headings->nelts; i++) {
+        if (heading[i].anchor) {
+            heading[i].anchor = apr_pstrdup(p, heading[i].anchor);
+        }
+    }
+    copy->source = apr_pmemdup(p, index->source, index->source_size);
+
+    return copy;
+}
+
+/*
+ * Heading index of a local document, per child: looked up by file, mtime
+ * and render profile, built from data on a miss (NULL without data).
+ */
+static hoedown_index_t *
+index_get(request_rec *r, hoedown_config_rec *cfg, char const *filename,
+          apr_finfo_t *finfo, const uint8_t *data, size_t size)
+{
+    hoedown_index_t *index, *found, *lru;
+    hoedown_heading_t *heading;
+    apr_hash_index_t *hi;
+    apr_pool_t *pool;
+    char *key;
+    int i;
+
+    key = apr_pstrcat(r->pool, filename, "\n",
+                      hoedown_context_profile(r->pool, cfg, 1, 6, 1), NULL);
+
+    if (hoedown_indexes.hash) {
+        index_lock();
+        found = apr_hash_get(hoedown_indexes.hash, key, APR_HASH_KEY_STRING);
+        if (found && found->mtime == finfo->mtime
+            && found->size == finfo->size) {
+            found->used = apr_time_now();
+            index = index_copy(r->pool, found);
+            index_unlock();
+            return index;
+        }
+        index_unlock();
+    }
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    if (hoedown_indexes.hash) {
+        index_lock();
+        apr_pool_create(&pool, hoedown_indexes.pool);
+        index_unlock();
+    } else {
+        pool = r->pool;
+    }
+
+    /* build outside of the lock */
+    index = apr_pcalloc(pool, sizeof(hoedown_index_t));
+    index->pool = pool;
+    index->key = apr_pstrdup(pool, key);
+    index->mtime = finfo->mtime;
+    index->size = finfo->size;
+    index->used = apr_time_now();
+    index->headings = hoedown_headings(pool, cfg, data, size);
+
+    heading = (hoedown_heading_t *)index->headings->elts;
+    for (i = 0; i < index->headings->nelts; i++) {
+        index->source_size += heading[i].length + 1;
+    }
+    index->source = apr_palloc(pool, index->source_size + 1);
+    index->source_size = 0;
+    for (i = 0; i < index->headings->nelts; i++) {
+        memcpy(index->source + index->source_size,
+               data + heading[i].offset, heading[i].length);
+        index->source_size += heading[i].length;
+        /* a blank line: headings on their own */
+        index->source[index->source_size++] = '\n';
+    }
+
+    if (pool == r->pool) {
+        return index;
+    }
+
+    index_lock();
+    found = apr_hash_get(hoedown_indexes.hash, key, APR_HASH_KEY_STRING);
+    if (found) {
+        apr_hash_set(hoedown_indexes.hash, found->key, APR_HASH_KEY_STRING,
+                     NULL);
+        apr_pool_destroy(found->pool);
+    } else if (apr_hash_count(hoedown_indexes.hash) >= HOEDOWN_INDEX_MAX) {
+        lru = NULL;
+        for (hi = apr_hash_first(NULL, hoedown_indexes.hash); hi;
+             hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&found);
+            if (lru == NULL || found->used < lru->used) {
+                lru = found;
+            }
+        }
+        apr_hash_set(hoedown_indexes.hash, lru->key, APR_HASH_KEY_STRING,
+                     NULL);
+        apr_pool_destroy(lru->pool);
+    }
+    apr_hash_set(hoedown_indexes.hash, index->key, APR_HASH_KEY_STRING,
+                 index);
+    index = index_copy(r->pool, index);
+    index_unlock();
+
+    return index;
+}
+
+/* the heading of an anchor, within the toc levels */
+static hoedown_heading_t *
+index_find(hoedown_index_t *index, char const *anchor,
+           int toc_begin, int toc_end)
+{
+    hoedown_heading_t *heading = (hoedown_heading_t *)index->headings->elts;
+    int i;
+
+    for (i = 0; i < index->headings->nelts; i++) {
+        if (heading[i].level >= toc_begin && heading[i].level <= toc_end
+            && heading[i].anchor && strcmp(heading[i].anchor, anchor) == 0) {
+            return &heading[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* toc levels: the toc parameter (begin[:end]) over HoedownTocBegin/End */
+static void
+toc_range(request_rec *r, hoedown_config_rec *cfg, char const *toc,
+          int *toc_begin, int *toc_end)
+{
+    char *delim;
+    int n;
+
+    *toc_begin = cfg->toc.begin;
+    *toc_end = cfg->toc.end;
+
+    if (toc == NULL || strlen(toc) == 0) {
+        return;
+    }
+
+    delim = strstr(toc, ":");
+    if (delim) {
+        n = atoi(apr_pstrndup(r->pool, toc, delim - toc));
+        if (n) {
+            *toc_begin = n;
+        }
+        n = atoi(delim + 1);
+        if (n) {
+            *toc_end = n;
+        }
+    } else {
+        n = atoi(toc);
+        if (n) {
+            *toc_begin = n;
+        }
+    }
+}
+
+/*
+ * Render a document block by block (see hoedown_chunks), reusing the html
+ * of the blocks rendered for it last time. Returns 0 when the document
+ * has to be rendered whole.
+ */
+static int
+render_incremental(request_rec *r, hoedown_config_rec *cfg,
+                   hoedown_context_t *ctx, char const *document,
+                   const uint8_t *data, size_t size, hoedown_buffer *ob)
+{
+    apr_array_header_t *chunks;
+    hoedown_chunk_t *chunk;
+    hoedown_incremental_t *old, *entry, *lru;
+    hoedown_rendered_t *rendered;
+    hoedown_buffer *block;
+    apr_hash_index_t *hi;
+    apr_pool_t *pool;
+    char *key;
+    int i, renders = 0;
+
+    if (hoedown_incrementals.hash == NULL) {
+        return 0;
+    }
+
+    chunks = hoedown_chunks(r->pool, cfg, data, size, NULL);
+    if (chunks == NULL || chunks->nelts < 2) {
+        return 0;
+    }
+
+    key = apr_pstrcat(r->pool, document, "\n",
+                      hoedown_context_profile(r->pool, cfg, cfg->toc.begin,
+                                              cfg->toc.end, 0), NULL);
+
+    /* ours until the new blocks replace it */
+    incremental_lock();
+    old = apr_hash_get(hoedown_incrementals.hash, key, APR_HASH_KEY_STRING);
+    if (old) {
+        apr_hash_set(hoedown_incrementals.hash, old->key,
+                     APR_HASH_KEY_STRING, NULL);
+    }
+    apr_pool_create(&pool, hoedown_incrementals.pool);
+    incremental_unlock();
+
+    entry = apr_palloc(pool, sizeof(hoedown_incremental_t));
+    entry->pool = pool;
+    entry->key = apr_pstrdup(pool, key);
+    entry->blocks = apr_hash_make(pool);
+    entry->used = apr_time_now();
+
+    /* the renderer starts a block with a newline unless it is the first */
+    block = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+
+    chunk = (hoedown_chunk_t *)chunks->elts;
+    for (i = 0; i < chunks->nelts; i++, chunk++) {
+        const uint8_t *html;
+        apr_size_t html_size;
+
+        rendered = apr_hash_get(entry->blocks, chunk->data, chunk->size);
+        if (rendered == NULL) {
+            hoedown_rendered_t *prev = NULL;
+
+            if (old) {
+                prev = apr_hash_get(old->blocks, chunk->data, chunk->size);
+            }
+            if (prev) {
+                html = prev->html;
+                html_size = prev->size;
+            } else {
+                block->size = 0;
+                hoedown_buffer_putc(block, '\n');
+                hoedown_context_render(ctx, chunk->data, chunk->size,
+                                       NULL, block);
+                html = block->data + 1;
+                html_size = block->size - 1;
+                renders++;
+            }
+
+            rendered = apr_palloc(pool, sizeof(hoedown_rendered_t));
+            rendered->html = apr_pmemdup(pool, html, html_size);
+            rendered->size = html_size;
+            apr_hash_set(entry->blocks,
+                         apr_pmemdup(pool, chunk->data, chunk->size),
+                         chunk->size, rendered);
+        }
+
+        html = rendered->html;
+        html_size = rendered->size;
+        if (ob->size == 0 && html_size > 0 && html[0] == '\n') {
+            html++;
+            html_size--;
+        }
+        hoedown_buffer_put(ob, html, html_size);
+    }
+
+    hoedown_buffer_free(block);
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                  "hoedown: %s: rendered %d of %d blocks",
+                  document, renders, chunks->nelts);
+
+    incremental_lock();
+    if (old) {
+        apr_pool_destroy(old->pool);
+    }
+    /* a concurrent render of the document got there first */
+    old = apr_hash_get(hoedown_incrementals.hash, key, APR_HASH_KEY_STRING);
+    if (old) {
+        apr_hash_set(hoedown_incrementals.hash, old->key,
+                     APR_HASH_KEY_STRING, NULL);
+        apr_pool_destroy(old->pool);
+    } else if (apr_hash_count(hoedown_incrementals.hash)
+               >= HOEDOWN_INCREMENTAL_MAX) {
+        lru = NULL;
+        for (hi = apr_hash_first(NULL, hoedown_incrementals.hash); hi;
+             hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&old);
+            if (lru == NULL || old->used < lru->used) {
+                lru = old;
+            }
+        }
+        apr_hash_set(hoedown_incrementals.hash, lru->key,
+                     APR_HASH_KEY_STRING, NULL);
+        apr_pool_destroy(lru->pool);
+    }
+    apr_hash_set(hoedown_incrementals.hash, entry->key, APR_HASH_KEY_STRING,
+                 entry);
+    incremental_unlock();
+
+    return 1;
+}
+
+/*
+ * The markdown of a section, rendered as a page of its own: after the
+ * link references of the whole document (see hoedown_chunks). NULL when
+ * they cannot be told apart, or with footnotes: the section is then cut
+ * out of the page of the document (section_trim).
+ */
+static const uint8_t *
+section_source(request_rec *r, hoedown_config_rec *cfg,
+               const uint8_t *data, size_t size, hoedown_heading_t *heading,
+               size_t *source_size)
+{
+    hoedown_chunk_t refs;
+
+    if (hoedown_chunks(r->pool, cfg, data, size, &refs) == NULL) {
+        return NULL;
+    }
+
+    return hoedown_chunk_source(r->pool, data, &refs,
+                                data + heading->offset,
+                                heading->end - heading->offset,
+                                source_size);
+}
+
+/* memmem, which is not everywhere */
+static const uint8_t *
+section_find(const uint8_t *html, size_t size, char const *str, size_t len)
+{
+    const uint8_t *end = html + size;
+
+    while (len > 0 && (size_t)(end - html) >= len
+           && (html = memchr(html, *str, end - html - len + 1)) != NULL) {
+        if (memcmp(html, str, len) == 0) {
+            return html;
+        }
+        html++;
+    }
+
+    return NULL;
+}
+
+/* the tag of the heading with the anchor as its id */
+static const uint8_t *
+section_heading(apr_pool_t *p, const uint8_t *html, size_t size,
+                char const *anchor)
+{
+    const uint8_t *id, *tag;
+    char *attr;
+    size_t len;
+
+    if (anchor == NULL) {
+        return NULL;
+    }
+
+    attr = apr_pstrcat(p, " id=\"", anchor, "\"", NULL);
+    len = strlen(attr);
+
+    /* the first of <h1 ...> to <h6 ...> with it */
+    while ((id = section_find(html, size, attr, len)) != NULL) {
+        for (tag = id; tag > html && *tag != '<'; tag--);
+        if (tag + 3 <= id && tag[0] == '<' && tag[1] == 'h'
+            && tag[2] >= '1' && tag[2] <= '6' && tag[3] == ' ') {
+            return tag;
+        }
+        size -= id + len - html;
+        html = id + len;
+    }
+
+    return NULL;
+}
+
+/*
+ * Cut a section out of the html of the whole document, rendered at from
+ * in page: from its heading to the next one of its level or above, with
+ * the footnotes of the document after it. Left whole when the heading is
+ * not found.
+ */
+static void
+section_trim(apr_pool_t *p, hoedown_buffer *page, apr_size_t from,
+             hoedown_heading_t *heading)
+{
+    static const char footnotes_tag[] = "<div class=\"footnotes\">";
+    uint8_t *html = page->data + from;
+    size_t size = page->size - from, n, m;
+    const uint8_t *begin, *end = NULL, *footnotes, *tag;
+
+    begin = section_heading(p, html, size, heading->anchor);
+    if (begin == NULL) {
+        return;
+    }
+
+    /* the next heading of its level or above: <h1> to <hN> */
+    for (tag = begin + 1; tag + 3 < html + size; tag++) {
+        tag = memchr(tag, '<', html + size - 3 - tag);
+        if (tag == NULL) {
+            break;
+        }
+        if (tag[1] == 'h' && tag[2] >= '1' && tag[2] <= '0' + heading->level
+            && (tag[3] == '>' || tag[3] == ' ')) {
+            end = tag;
+            break;
+        }
+    }
+
+    footnotes = section_find(begin, html + size - begin, footnotes_tag,
+                             sizeof(footnotes_tag) - 1);
+    if (end == NULL) {
+        end = footnotes ? footnotes : html + size;
+    }
+
+    n = end - begin;
+    memmove(html, begin, n);
+    if (footnotes && footnotes >= end) {
+        m = html + size - footnotes;
+        memmove(html + n, footnotes, m);
+        n += m;
+    }
+    page->size = from + n;
+}
+#if APR_HAS_THREADS
+/* the parts of a document still rendering */
+typedef struct {
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+    int pending;
+} hoedown_parallel_job_t;
+
+typedef struct {
+    hoedown_parallel_job_t *job;
+    hoedown_config_rec *cfg;
+    char const *profile;
+    const uint8_t *data;
+    size_t size;
+    hoedown_buffer *ob;
+} hoedown_part_t;
+
+/* on a render thread: a context of its own, and no pool */
+static void * APR_THREAD_FUNC
+render_part(apr_thread_t * UNUSED(thread), void *data)
+{
+    hoedown_part_t *part = data;
+    hoedown_parallel_job_t *job = part->job;
+    hoedown_config_rec *cfg = part->cfg;
+    hoedown_context_t *ctx;
+
+    /* the renderer starts a block with a newline unless it is the first */
+    part->ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    hoedown_buffer_grow(part->ob, part->size + (part->size >> 1));
+    hoedown_buffer_putc(part->ob, '\n');
+
+    ctx = context_take(cfg, part->profile, cfg->toc.begin, cfg->toc.end, 0);
+    if (ctx) {
+        hoedown_context_render(ctx, part->data, part->size, NULL, part->ob);
+        context_release();
+    } else {
+        hoedown_render(cfg, cfg->toc.begin, cfg->toc.end,
+                       part->data, part->size, NULL, part->ob);
+    }
+
+    apr_thread_mutex_lock(job->mutex);
+    if (--job->pending == 0) {
+        apr_thread_cond_signal(job->cond);
+    }
+    apr_thread_mutex_unlock(job->mutex);
+
+    return NULL;
+}
+
+/*
+ * Render a large document on the render threads: its top level blocks
+ * (see hoedown_chunks) are grouped into a few parts per thread, each
+ * rendered with the link references of the whole document, and joined
+ * in order. The first part is rendered here. Returns 0 when the document
+ * has to be rendered whole.
+ */
+static int
+render_parallel(request_rec *r, hoedown_config_rec *cfg,
+                const uint8_t *data, size_t size, hoedown_buffer *ob)
+{
+    apr_array_header_t *chunks;
+    hoedown_chunk_t *chunk, refs;
+    hoedown_parallel_job_t job;
+    hoedown_part_t *parts, *part;
+    char const *profile;
+    const uint8_t *begin;
+    size_t target, part_size;
+    int i, n, max;
+
+    if (hoedown_parallel.pool == NULL) {
+        return 0;
+    }
+
+    chunks = hoedown_chunks(r->pool, cfg, data, size, &refs);
+    if (chunks == NULL || chunks->nelts < 2) {
+        return 0;
+    }
+
+    if (apr_thread_mutex_create(&job.mutex, APR_THREAD_MUTEX_DEFAULT,
+                                r->pool) != APR_SUCCESS
+        || apr_thread_cond_create(&job.cond, r->pool) != APR_SUCCESS) {
+        return 0;
+    }
+
+    max = hoedown_parallel.threads * HOEDOWN_PARALLEL_PARTS;
+    if (max > chunks->nelts) {
+        max = chunks->nelts;
+    }
+    target = size / max;
+
+    profile = hoedown_context_profile(r->pool, cfg, cfg->toc.begin,
+                                      cfg->toc.end, 0);
+    parts = apr_pcalloc(r->pool, max * sizeof(hoedown_part_t));
+
+    /* consecutive blocks, up to the part size */
+    chunk = (hoedown_chunk_t *)chunks->elts;
+    begin = chunk[0].data;
+    part_size = 0;
+    n = 0;
+    for (i = 0; i < chunks->nelts; i++) {
+        part_size += chunk[i].size;
+        if ((part_size < target || n == max - 1) && i < chunks->nelts - 1) {
+            continue;
+        }
+
+        part = &parts[n++];
+        part->job = &job;
+        part->cfg = cfg;
+        part->profile = profile;
+        part->data = hoedown_chunk_source(r->pool, data, &refs, begin,
+                                          part_size, &part->size);
+
+        begin = chunk[i].data + chunk[i].size;
+        part_size = 0;
+    }
+
+    job.pending = n;
+    for (i = 1; i < n; i++) {
+        if (apr_thread_pool_push(hoedown_parallel.pool, render_part,
+                                 &parts[i], APR_THREAD_TASK_PRIORITY_NORMAL,
+                                 r) != APR_SUCCESS) {
+            render_part(NULL, &parts[i]);
+        }
+    }
+    render_part(NULL, &parts[0]);
+
+    apr_thread_mutex_lock(job.mutex);
+    while (job.pending > 0) {
+        apr_thread_cond_wait(job.cond, job.mutex);
+    }
+    apr_thread_mutex_unlock(job.mutex);
+
+    for (i = 0; i < n; i++) {
+        hoedown_chunk_join(ob, parts[i].ob);
+        hoedown_buffer_free(parts[i].ob);
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                  "hoedown: %s: rendered in %d parts of %d blocks",
+                  r->filename, n, chunks->nelts);
+
+    return 1;
+}
+#endif
+
+/*
+ * A render within HoedownRenderBudget: the top level blocks (see
+ * hoedown_chunks) a few at a time, with the link references of the whole
+ * document, the time checked between the steps. A document that cannot
+ * be split so (footnotes, a toc, a single block) is a single step, and
+ * its page is dropped when it took too long. Nothing of it is allocated
+ * from a request pool: a render thread may take it after the request.
+ */
+typedef struct {
+    hoedown_context_t *ctx;
+    const uint8_t *data;
+    size_t size;
+    uint8_t *refs;
+    size_t refs_size;
+    size_t begin;
+    size_t *steps;
+    int nsteps;
+    apr_time_t deadline;
+    hoedown_buffer *ob;
+    hoedown_buffer *toc_ob;
+    apr_interval_time_t toc_time;
+    int rendered;
+#if APR_HAS_THREADS
+    uint8_t *copy;
+    int started;
+    int done;
+    int overrun;
+    int refs_count;
+#endif
+} hoedown_budget_t;
+
+static void
+budget_clear(hoedown_budget_t *job)
+{
+    free(job->steps);
+    free(job->refs);
+    job->steps = NULL;
+    job->refs = NULL;
+    job->nsteps = 0;
+}
+
+/* the steps of the document, none when it is rendered whole */
+static void
+budget_plan(request_rec *r, hoedown_config_rec *cfg, hoedown_budget_t *job,
+            int toc)
+{
+    apr_array_header_t *chunks;
+    hoedown_chunk_t *chunk, refs;
+    size_t part_size = 0;
+    int i;
+
+    if (toc) {
+        return;
+    }
+
+    chunks = hoedown_chunks(r->pool, cfg, job->data, job->size, &refs);
+    if (chunks == NULL || chunks->nelts < 2) {
+        return;
+    }
+
+    job->steps = malloc(chunks->nelts * sizeof(size_t));
+    job->refs = refs.size ? malloc(refs.size) : NULL;
+    if (job->steps == NULL || (refs.size && job->refs == NULL)) {
+        budget_clear(job);
+        return;
+    }
+    if (refs.size) {
+        memcpy(job->refs, refs.data, refs.size);
+        job->refs_size = refs.size;
+    }
+
+    chunk = (hoedown_chunk_t *)chunks->elts;
+    job->begin = chunk[0].data - job->data;
+    for (i = 0; i < chunks->nelts; i++) {
+        part_size += chunk[i].size;
+        if (part_size < HOEDOWN_BUDGET_STEP && i < chunks->nelts - 1) {
+            continue;
+        }
+        job->steps[job->nsteps++] = chunk[i].data + chunk[i].size
+            - job->data;
+        part_size = 0;
+    }
+
+    /* a single step is the document */
+    if (job->nsteps < 2) {
+        budget_clear(job);
+    }
+}
+
+/* 1 when rendered, 0 when the time ran out */
+static int
+budget_run(hoedown_budget_t *job)
+{
+    hoedown_buffer *source, *part;
+    size_t begin = job->begin, end;
+    int i;
+
+    if (job->nsteps == 0) {
+        job->toc_time = hoedown_context_render(job->ctx, job->data,
+                                               job->size, job->toc_ob,
+                                               job->ob);
+        return apr_time_now() <= job->deadline;
+    }
+
+    source = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    part = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+
+    for (i = 0; i < job->nsteps; i++) {
+        end = job->steps[i];
+
+        hoedown_buffer_reset(source);
+        if (job->refs_size) {
+            hoedown_buffer_put(source, job->refs, job->refs_size);
+            /* hoedown only skips a BOM at the start */
+            if (begin == 0 && end >= 3
+                && memcmp(job->data, "\xef\xbb\xbf", 3) == 0) {
+                begin = 3;
+            }
+        }
+        hoedown_buffer_put(source, job->data + begin, end - begin);
+
+        /* the renderer starts a block with a newline unless it is first */
+        hoedown_buffer_reset(part);
+        hoedown_buffer_putc(part, '\n');
+        hoedown_context_render(job->ctx, source->data, source->size, NULL,
+                               part);
+        hoedown_chunk_join(job->ob, part);
+
+        begin = end;
+
+        if (i < job->nsteps - 1 && apr_time_now() > job->deadline) {
+            break;
+        }
+    }
+
+    hoedown_buffer_free(part);
+    hoedown_buffer_free(source);
+
+    return i >= job->nsteps;
+}
+
+#if APR_HAS_THREADS
+/* a render thread job: freed by whichever of the request and it is last */
+static void
+detached_free(hoedown_budget_t *job)
+{
+    budget_clear(job);
+    if (job->ctx) {
+        hoedown_context_free(job->ctx);
+    }
+    if (job->ob) {
+        hoedown_buffer_free(job->ob);
+    }
+    if (job->toc_ob) {
+        hoedown_buffer_free(job->toc_ob);
+    }
+    free(job->copy);
+    free(job);
+}
+
+/*
+ * On a render thread: a job the request no longer waits for, or whose
+ * time is up before it starts, is not rendered.
+ */
+static void * APR_THREAD_FUNC
+render_detached(apr_thread_t * UNUSED(thread), void *data)
+{
+    hoedown_budget_t *job = data;
+    int rendered = 0, refs;
+
+    apr_thread_mutex_lock(hoedown_parallel.mutex);
+    job->started = job->refs_count == 2
+        && apr_time_now() <= job->deadline;
+    apr_thread_mutex_unlock(hoedown_parallel.mutex);
+
+    if (job->started) {
+        rendered = budget_run(job);
+    }
+
+    apr_thread_mutex_lock(hoedown_parallel.mutex);
+    job->rendered = rendered;
+    job->done = 1;
+    if (job->overrun) {
+        hoedown_parallel.overruns--;
+    }
+    refs = --job->refs_count;
+    apr_thread_cond_broadcast(hoedown_parallel.cond);
+    apr_thread_mutex_unlock(hoedown_parallel.mutex);
+
+    if (refs == 0) {
+        detached_free(job);
+    }
+
+    return NULL;
+}
+
+/*
+ * Render on a render thread, waited for up to the deadline. A render
+ * still running then stops at its next step; one that cannot be split
+ * runs to its end, and at most half the render threads are left to such
+ * renders, for the others (render_parallel) not to wait behind them.
+ * Returns 1 when rendered, 0 when the time ran out, -1 when the render
+ * is to be done here.
+ */
+static int
+render_wait(request_rec *r, hoedown_config_rec *cfg, int toc_begin,
+            int toc_end, const uint8_t *data, size_t size,
+            hoedown_buffer *toc_ob, hoedown_buffer *ob, apr_time_t deadline,
+            apr_interval_time_t *toc_time)
+{
+    hoedown_budget_t *job;
+    apr_pool_t *arena;
+    apr_time_t now;
+    int done, rendered, refs, full;
+
+    if (hoedown_parallel.pool == NULL || hoedown_parallel.mutex == NULL) {
+        return -1;
+    }
+
+    apr_thread_mutex_lock(hoedown_parallel.mutex);
+    full = hoedown_parallel.overruns >= hoedown_parallel.threads / 2;
+    apr_thread_mutex_unlock(hoedown_parallel.mutex);
+    if (full) {
+        return -1;
+    }
+
+    job = calloc(1, sizeof(hoedown_budget_t));
+    if (job == NULL) {
+        return -1;
+    }
+    job->data = data;
+    job->size = size;
+    job->deadline = deadline;
+    job->refs_count = 2;
+    budget_plan(r, cfg, job, toc_ob != NULL);
+
+    /* the heap, not the arena of the request */
+    arena = hoedown_arena_set(NULL);
+    job->copy = malloc(size ? size : 1);
+    job->ctx = hoedown_context_new(cfg, toc_begin, toc_end, toc_ob != NULL);
+    job->ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    if (toc_ob) {
+        job->toc_ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    }
+    hoedown_arena_set(arena);
+
+    if (job->copy == NULL || job->ctx == NULL) {
+        detached_free(job);
+        return -1;
+    }
+    memcpy(job->copy, data, size);
+    job->data = job->copy;
+
+    if (apr_thread_pool_push(hoedown_parallel.pool, render_detached, job,
+                             APR_THREAD_TASK_PRIORITY_NORMAL,
+                             NULL) != APR_SUCCESS) {
+        detached_free(job);
+        return -1;
+    }
+
+    apr_thread_mutex_lock(hoedown_parallel.mutex);
+    while (!job->done && (now = apr_time_now()) < deadline) {
+        apr_thread_cond_timedwait(hoedown_parallel.cond,
+                                  hoedown_parallel.mutex, deadline - now);
+    }
+    done = job->done;
+    rendered = job->rendered;
+    if (!done && job->started) {
+        job->overrun = 1;
+        hoedown_parallel.overruns++;
+    }
+    refs = --job->refs_count;
+    apr_thread_mutex_unlock(hoedown_parallel.mutex);
+
+    if (done && rendered) {
+        hoedown_buffer_put(ob, job->ob->data, job->ob->size);
+        if (toc_ob) {
+            hoedown_buffer_put(toc_ob, job->toc_ob->data,
+                               job->toc_ob->size);
+        }
+        *toc_time = job->toc_time;
+    }
+
+    if (refs == 0) {
+        detached_free(job);
+    }
+
+    return done && rendered;
+}
+#endif
+
+/*
+ * Render within HoedownRenderBudget: on a render thread when there are
+ * any (render_wait), here otherwise. Returns 1 when rendered, 0 when the
+ * time ran out.
+ */
+static int
+render_budgeted(request_rec *r, hoedown_config_rec *cfg,
+                int toc_begin, int toc_end, const uint8_t *data,
+                size_t size, hoedown_buffer *toc_ob, hoedown_buffer *ob,
+                apr_time_t deadline, apr_interval_time_t *toc_time)
+{
+    hoedown_budget_t job;
+    int ret, own = 0;
+
+    *toc_time = 0;
+
+#if APR_HAS_THREADS
+    ret = render_wait(r, cfg, toc_begin, toc_end, data, size, toc_ob, ob,
+                      deadline, toc_time);
+    if (ret >= 0) {
+        return ret;
+    }
+#endif
+
+    memset(&job, 0, sizeof(job));
+    job.data = data;
+    job.size = size;
+    job.deadline = deadline;
+    job.ob = ob;
+    job.toc_ob = toc_ob;
+
+    job.ctx = context_acquire(r, cfg, toc_begin, toc_end, toc_ob != NULL);
+    if (job.ctx == NULL) {
+        job.ctx = hoedown_context_new(cfg, toc_begin, toc_end,
+                                      toc_ob != NULL);
+        own = 1;
+    }
+    if (job.ctx == NULL) {
+        return 0;
+    }
+
+    budget_plan(r, cfg, &job, toc_ob != NULL);
+    ret = budget_run(&job);
+    budget_clear(&job);
+    *toc_time = job.toc_time;
+
+    if (own) {
+        hoedown_context_free(job.ctx);
+    } else {
+        context_release();
+    }
+
+    return ret;
+}
+
+/*
+ * Render markdown into the brigade when streaming, or into the page
+ * buffer; the toc, when enabled, goes before the body. Returns 0, with
+ * nothing written, when HoedownRenderBudget ran out.
+ */
+static int
+render_body(request_rec *r, hoedown_config_rec *cfg, char const *toc,
+            const uint8_t *data, size_t size, int body,
+            apr_bucket_brigade *bb, hoedown_buffer *page)
+{
+    int toc_begin = cfg->toc.begin, toc_end = cfg->toc.end;
+    int budget = -1;
+    hoedown_buffer *ob, *toc_ob = NULL;
+    hoedown_context_t *ctx;
+    hoedown_timing_t *timing = timing_get(r);
+    apr_interval_time_t toc_time;
+    apr_time_t start;
+
+    /* performing markdown parsing */
+    ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    hoedown_buffer_grow(ob, size + (size >> 1));
+
+    /* toc */
+    if (cfg->html & HOEDOWN_HTML_TOC) {
+        toc_range(r, cfg, toc, &toc_begin, &toc_end);
+        toc_ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+    }
+
+    start = apr_time_now();
+    if (cfg->render_budget > 0) {
+        budget = render_budgeted(r, cfg, toc_begin, toc_end, data, size,
+                                 toc_ob, ob,
+                                 start
+                                 + apr_time_from_msec(cfg->render_budget),
+                                 &toc_time);
+    } else
+#if APR_HAS_THREADS
+    if (toc_ob == NULL && body && cfg->parallel > 0
+        && size >= (size_t)cfg->parallel
+        && render_parallel(r, cfg, data, size, ob)) {
+        ctx = NULL;
+        toc_time = 0;
+    } else
+#endif
+    if ((ctx = context_acquire(r, cfg, toc_begin, toc_end,
+                               toc_ob != NULL)) != NULL
+        && toc_ob == NULL && body && cfg->incremental > 0
+        && size >= (size_t)cfg->incremental && timing->document
+        && render_incremental(r, cfg, ctx, timing->document, data, size,
+                              ob)) {
+        toc_time = 0;
+        context_release();
+    } else if (ctx) {
+        toc_time = hoedown_context_render(ctx, data, size, toc_ob, ob);
+        context_release();
+    } else {
+        toc_time = hoedown_render(cfg, toc_begin, toc_end, data, size,
+                                  toc_ob, ob);
+    }
+    timing_add(timing, HOEDOWN_PHASE_RENDER,
+               apr_time_now() - start - toc_time);
+    if (toc_ob) {
+        timing_add(timing, HOEDOWN_PHASE_TOC, toc_time);
+    }
+
+    if (budget == 0) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                      "hoedown: %s: not rendered in HoedownRenderBudget",
+                      timing->document ? timing->document : r->uri);
+        if (toc_ob) {
+            hoedown_buffer_free(toc_ob);
+        }
+        hoedown_buffer_free(ob);
+        return 0;
+    }
+
+    /* toc goes before the body */
+    if (toc_ob) {
+        if (bb) {
+            output_buffer(bb, toc_ob);
+        } else {
+            hoedown_buffer_put(page, toc_ob->data, toc_ob->size);
+        }
+
+        hoedown_buffer_free(toc_ob);
+    }
+
+    /* writing the result */
+    if (!body) {
+        /* the toc only */
+    } else if (bb) {
+        output_buffer(bb, ob);
+    } else {
+        hoedown_buffer_put(page, ob->data, ob->size);
+    }
+
+    /* cleanup */
+    hoedown_buffer_free(ob);
+
+    return 1;
+}
+
+/* renders of the child: a slot is left when the request is done */
+static apr_status_t
+render_leave(void * UNUSED(data))
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(hoedown_renders.mutex);
+    hoedown_renders.active--;
+    apr_thread_cond_signal(hoedown_renders.cond);
+    apr_thread_mutex_unlock(hoedown_renders.mutex);
+#endif
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Take a render slot of the child, waiting for one up to the queue
+ * timeout of HoedownMaxConcurrentRenders: 503 with Retry-After when none
+ * is left. *admitted is set when a slot was taken.
+ */
+static int
+render_admit(request_rec *r, int *admitted)
+{
+#if APR_HAS_THREADS
+    apr_time_t deadline, now;
+
+    *admitted = 0;
+
+    if (hoedown_renders.max <= 0 || hoedown_renders.mutex == NULL) {
+        return OK;
+    }
+
+    deadline = apr_time_now() + apr_time_from_msec(hoedown_renders.timeout);
+
+    apr_thread_mutex_lock(hoedown_renders.mutex);
+    while (hoedown_renders.active >= hoedown_renders.max
+           && (now = apr_time_now()) < deadline) {
+        apr_thread_cond_timedwait(hoedown_renders.cond,
+                                  hoedown_renders.mutex, deadline - now);
+    }
+    if (hoedown_renders.active < hoedown_renders.max) {
+        hoedown_renders.active++;
+        *admitted = 1;
+    }
+    apr_thread_mutex_unlock(hoedown_renders.mutex);
+
+    if (!*admitted) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                      "hoedown: %d renders running, %s is not rendered",
+                      hoedown_renders.max, r->uri);
+        apr_table_setn(r->err_headers_out, "Retry-After",
+                       apr_itoa(r->pool, hoedown_renders.timeout > 1000
+                                ? (hoedown_renders.timeout + 999) / 1000
+                                : 1));
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
+
+    apr_pool_cleanup_register(r->pool, &hoedown_renders, render_leave,
+                              apr_pool_cleanup_null);
+#else
+    /* a request at a time */
+    *admitted = 0;
+#endif
+
+    return OK;
+}
+
+/* markdown sent as it is instead of its page: for no cache to keep */
+static void
+output_text_headers(request_rec *r, apr_off_t size)
+{
+    r->content_type = "text/plain";
+    apr_table_unset(r->headers_out, "ETag");
+    apr_table_unset(r->headers_out, "Last-Modified");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-store");
+    ap_set_content_length(r, size);
+}
+
+/*
+ * The markdown of a local page as it is: a file bucket, sent with
+ * sendfile when EnableSendfile is on, and cut by the byterange filter
+ * for a Range. DECLINED when there is no such file to send.
+ */
+static int
+raw_handler(request_rec *r, hoedown_config_rec *cfg)
+{
+    core_dir_config *core;
+    apr_bucket_brigade *bb;
+    apr_file_t *fp;
+    apr_finfo_t finfo;
+    apr_int32_t flags = APR_READ | APR_BINARY;
+    apr_status_t rv;
+    apr_time_t start;
+    char *filename;
+    int ret;
+
+    filename = page_stat(r, cfg, &finfo);
+    if (filename == NULL || finfo.size == 0) {
+        return DECLINED;
+    }
+
+    timing_get(r)->document = filename;
+
+    ret = page_validate(r, hoedown_page_fingerprint(r->pool, cfg, filename,
+                                                    &finfo, NULL, NULL,
+                                                    NULL, "\nraw"),
+                        NULL, &finfo, NULL);
+    if (ret != OK) {
+        return ret;
+    }
+
+    core = ap_get_module_config(r->per_dir_config, &core_module);
+    if (core->enable_sendfile == ENABLE_SENDFILE_ON) {
+        flags |= APR_SENDFILE_ENABLED;
+    }
+
+    rv = apr_file_open(&fp, filename, flags, APR_OS_DEFAULT, r->pool);
+    if (rv != APR_SUCCESS) {
+        return file_status(rv);
+    }
+
+    r->content_type = "text/plain";
+    ap_set_content_length(r, finfo.size);
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    apr_brigade_insert_file(bb, fp, 0, finfo.size, r->pool);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+
+    start = apr_time_now();
+    rv = ap_pass_brigade(r->output_filters, bb);
+    timing_add(timing_get(r), HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+    if (rv != APR_SUCCESS) {
+        return AP_FILTER_ERROR;
+    }
+
+    return OK;
+}
+
+/* serve a hoedown page: pre-rendered, cached or rendered now */
+static int
+page_handler(request_rec *r)
+{
+    int ret = -1;
+    int directory = 1;
+    hoedown_style_t *style_template = NULL;
+    char *style = NULL;
+    char *style_path = NULL;
+    char *url = NULL;
+    hoedown_buffer *text = NULL;
+    char *raw = NULL;
+    char *toc = NULL;
+    char *section = NULL;
+    int toc_only = 0;
+    char *filename = NULL;
+    apr_finfo_t finfo;
+    hoedown_index_t *index = NULL;
+    hoedown_heading_t *heading = NULL, *trim = NULL;
+    char *fingerprint = NULL;
+    char *key = NULL;
+    uint8_t *data = NULL;
+    size_t size = 0;
+    const uint8_t *source;
+    size_t source_size;
+    apr_size_t body_offset;
+    apr_mmap_t *mm = NULL;
+    apr_finfo_t style_finfo;
+    const hoedown_encoding_t *encoding = NULL;
+    apreq_handle_t *apreq = NULL;
+    const apr_table_t *params = NULL;
+    apr_bucket_brigade *bb = NULL;
+    apr_status_t rv;
+    apr_file_t *sidecar = NULL;
+    apr_off_t sidecar_offset = 0, sidecar_length = 0;
+    hoedown_coalesce_t *coalesce = NULL;
+    hoedown_timing_t *timing;
+    apr_time_t start;
+    int admitted = 0, rendered = 1;
+
+    hoedown_config_rec *cfg;
+
+    /* hoedown: markdown */
+    hoedown_buffer *ib, *page;
+
+    /* config */
+    cfg = ap_get_module_config(r->per_dir_config, &hoedown_module);
+
+    timing = timing_get(r);
+    timing->document = r->filename;
+
+    /* set contest type */
+    r->content_type = HOEDOWN_CONTENT_TYPE;
+
+    /* get parameter: the query string, and the body of a POST */
+    if (r->args && *r->args) {
+        apreq = apreq_handle_apache2(r);
+        apreq_args(apreq, &params);
+    }
+    if (r->method_number == M_POST) {
+        text = hoedown_buffer_new(HOEDOWN_READ_UNIT);
+        apr_pool_cleanup_register(r->pool, text, buffer_cleanup,
+                                  apr_pool_cleanup_null);
+
+        ret = read_post(r, cfg, &params, text);
+        if (ret == DECLINED) {
+            /* multipart and the like */
+            const char *markdown;
+
+            if (apreq == NULL) {
+                apreq = apreq_handle_apache2(r);
+            }
+            if (cfg->max_input_size > 0) {
+                apreq_read_limit_set(apreq, cfg->max_input_size);
+            }
+            params = apreq_params(apreq, r->pool);
+            if (params) {
+                markdown = apreq_params_as_string(r->pool, params,
+                                                  "markdown",
+                                                  APREQ_JOIN_AS_IS);
+                if (markdown) {
+                    append_data(text, (void *)markdown, strlen(markdown));
+                }
+            }
+        } else if (ret != OK) {
+            return ret;
+        }
+    }
+    if (params) {
+        style = (char *)apreq_params_as_string(r->pool, params,
+                                               "style", APREQ_JOIN_AS_IS);
+#ifdef HOEDOWN_URL_SUPPORT
+        url = (char *)apreq_params_as_string(r->pool, params,
+                                             "url", APREQ_JOIN_AS_IS);
+#endif
+        if (cfg->raw != 0) {
+            raw = (char *)apr_table_get(params, "raw");
+        }
+        if (cfg->html & HOEDOWN_HTML_TOC) {
+            toc = (char *)apr_table_get(params, "toc");
+            section = (char *)apr_table_get(params, "section");
+            toc_only = apr_table_get(params, "toc-only") != NULL;
+        }
+    }
+
+    /* raw markdown of a whole local file */
+    if (raw != NULL && (!url || strlen(url) == 0) && (!text || text->size == 0)
+        && section == NULL && !toc_only) {
+        ret = raw_handler(r, cfg);
+        if (ret != DECLINED) {
+            return ret;
+        }
+    }
+
+    /* style */
+    style_path = style_resolve(r, cfg, style, &style_finfo);
+
+    /* validators: only pages rendered from local files */
+    if ((!url || strlen(url) == 0) && (!text || text->size == 0)
+        && raw == NULL) {
+        filename = page_stat(r, cfg, &finfo);
+
+        /* too large to render: the file as it is, where HoedownRaw is on */
+        if (filename && cfg->max_input_size > 0
+            && finfo.size > cfg->max_input_size) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                          "hoedown: %s is larger than HoedownMaxInputSize%s",
+                          filename, cfg->raw != 0 ? ", sent as text" : "");
+            if (cfg->raw == 0) {
+                return HTTP_REQUEST_ENTITY_TOO_LARGE;
+            }
+            return raw_handler(r, cfg);
+        }
+
+        if (filename) {
+            char const *variant = toc;
+
+            /* a section or the toc only is a page of its own */
+            if (toc_only) {
+                variant = apr_pstrcat(r->pool, toc ? toc : "",
+                                      "\ntoc-only", NULL);
+            } else if (section) {
+                variant = apr_pstrcat(r->pool, toc ? toc : "",
+                                      "\nsection=", section, NULL);
+            }
+
+            /* the title is the request's, not that of the file found */
+            fingerprint = hoedown_page_fingerprint(r->pool, cfg,
+                                                   filename, &finfo,
+                                                   style_path, &style_finfo,
+                                                   hoedown_page_title(
+                                                       r->pool, r->filename),
+                                                   variant);
+
+            if (cfg->compression
+                && (cfg->prerendered
+                    || (hoedown_cache.provider && cfg->cache.ttl > 0))) {
+                apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+            }
+
+            /* pre-rendered sidecar, for the requested file itself */
+            if (cfg->prerendered && strcmp(filename, r->filename) == 0) {
+                sidecar = sidecar_open(r, cfg, filename, fingerprint,
+                                       &encoding, &sidecar_offset,
+                                       &sidecar_length);
+            }
+
+            /* pre-compressed variants live in the render cache */
+            if (sidecar == NULL && cfg->compression
+                && hoedown_cache.provider && cfg->cache.ttl > 0) {
+                encoding = negotiate_encoding(r);
+            }
+
+            ret = page_validate(r, fingerprint, encoding, &finfo,
+                                style_path ? &style_finfo : NULL);
+            if (ret != OK) {
+                return ret;
+            }
+        }
+    }
+
+    if (sidecar) {
+        if (encoding) {
+            apr_table_setn(r->headers_out, "Content-Encoding",
+                           encoding->name);
+        }
+        ap_set_content_length(r, sidecar_length);
+
+        if (r->header_only) {
+            return OK;
+        }
+
+        timing->cache = "sidecar";
+
+        bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        apr_brigade_insert_file(bb, sidecar, sidecar_offset, sidecar_length,
+                                r->pool);
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+
+        start = apr_time_now();
+        rv = ap_pass_brigade(r->output_filters, bb);
+        timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+        if (rv != APR_SUCCESS) {
+            return AP_FILTER_ERROR;
+        }
+
+        return OK;
+    }
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    /* cache */
+    if (fingerprint && hoedown_cache.provider && cfg->cache.ttl > 0) {
+        unsigned char *cached;
+        unsigned int cached_size;
+
+        key = fingerprint;
+
+        if (encoding
+            && cache_retrieve(r, cfg,
+                              apr_pstrcat(r->pool, key, encoding->suffix,
+                                          NULL),
+                              &cached, &cached_size) == APR_SUCCESS) {
+            timing->cache = "hit";
+            apr_table_setn(r->headers_out, "Content-Encoding",
+                           encoding->name);
+            ap_set_content_length(r, cached_size);
+
+            start = apr_time_now();
+            ap_rwrite(cached, cached_size, r);
+            timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+            return OK;
+        }
+
+        if (cache_retrieve(r, cfg, key, &cached, &cached_size) == APR_SUCCESS) {
+            timing->cache = "hit";
+            output_page(r, cfg, key, encoding, cached, cached_size);
+            return OK;
+        }
+
+        timing->cache = "miss";
+    }
+
+    /* a render of this page in progress */
+    if (fingerprint && cfg->coalesce > 0) {
+        unsigned char *coalesced;
+        apr_size_t coalesced_size;
+
+        if (flight_join(r, cfg, fingerprint, key, &coalesce,
+                        &coalesced, &coalesced_size)) {
+            timing->cache = "coalesced";
+            output_page(r, cfg, key, encoding, coalesced, coalesced_size);
+            return OK;
+        }
+    }
+
+    /* a render from here on */
+    ret = render_admit(r, &admitted);
+    if (ret != OK) {
+        return ret;
+    }
+
+    /* the toc only: from the heading index, the page is not read */
+    if (toc_only && filename) {
+        index = index_get(r, cfg, filename, &finfo, NULL, 0);
+    }
+
+    /* reading everything */
+    ib = hoedown_buffer_new(HOEDOWN_READ_UNIT);
+    hoedown_buffer_grow(ib, HOEDOWN_READ_UNIT);
+
+    /* page */
+    if (url || (text && text->size > 0)) {
+        directory = 0;
+    }
+    start = apr_time_now();
+    if (index == NULL) {
+        append_page_data(r, cfg, ib, r->filename, directory,
+                         directory ? &mm : NULL);
+    }
+
+    /* text: read in place when it is the whole input */
+    if (text && text->size > 0) {
+        if (ib->size == 0) {
+            apr_pool_cleanup_kill(r->pool, text, buffer_cleanup);
+            hoedown_buffer_free(ib);
+            ib = text;
+        } else {
+            append_data(ib, text->data, text->size);
+        }
+    }
+    timing_add(timing, HOEDOWN_PHASE_READ, apr_time_now() - start);
+
+#ifdef HOEDOWN_URL_SUPPORT
+    /* url */
+    if (url && strlen(url) > 0) {
+        timing->document = url;
+        start = apr_time_now();
+
+        ret = url_fetch(r, cfg, url, ib);
+
+        timing_add(timing, HOEDOWN_PHASE_FETCH, apr_time_now() - start);
+
+        if (ret != OK) {
+            hoedown_buffer_free(ib);
+            return ret;
+        }
+    }
+#endif
+
+    /* default page */
+    if (ib->size == 0 && mm == NULL && index == NULL) {
+        timing->document = cfg->default_page;
+        start = apr_time_now();
+        ret = append_page_data(r, cfg, ib, NULL, 0, &mm);
+        timing_add(timing, HOEDOWN_PHASE_READ, apr_time_now() - start);
+        if (ret != APR_SUCCESS) {
+            hoedown_buffer_free(ib);
+            return ret;
+        }
+    }
+
+    /* input: the mapped file, or everything read into ib */
+    if (mm) {
+        data = mm->mm;
+        size = mm->size;
+    } else {
+        data = ib->data;
+        size = ib->size;
+    }
+    timing->bytes_in = size;
+
+    /* one section, or the toc only */
+    if (filename && (section || toc_only)) {
+        if (index == NULL) {
+            index = index_get(r, cfg, filename, &finfo, data, size);
+        }
+        if (toc_only) {
+            data = index->source;
+            size = index->source_size;
+        } else {
+            int toc_begin, toc_end;
+
+            toc_range(r, cfg, toc, &toc_begin, &toc_end);
+            heading = index_find(index, section, toc_begin, toc_end);
+            if (heading == NULL) {
+                hoedown_buffer_free(ib);
+                return HTTP_NOT_FOUND;
+            }
+        }
+    }
+
+    /* a section: with the link references of the document, or cut out */
+    source = data;
+    source_size = size;
+    if (heading) {
+        source = section_source(r, cfg, data, size, heading, &source_size);
+        if (source == NULL) {
+            source = data;
+            source_size = size;
+            trim = heading;
+        }
+        data += heading->offset;
+        size = heading->end - heading->offset;
+    }
+
+    if (size > 0 && cfg->raw != 0 && raw != NULL) {
+        r->content_type = "text/plain";
+        start = apr_time_now();
+        ap_rwrite(data, size, r);
+        timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+        hoedown_buffer_free(ib);
+        return OK;
+    }
+
+    /* output page */
+    page = hoedown_buffer_new(HOEDOWN_PAGE_UNIT);
+
+    /* output style header */
+    start = apr_time_now();
+    style_template = style_header(r, page, style_path, &style_finfo,
+                                  r->filename);
+    timing_add(timing, HOEDOWN_PHASE_STYLE, apr_time_now() - start);
+
+    /* nothing to cache, compress or share: stream the page */
+    if (key == NULL && encoding == NULL && coalesce == NULL
+        && cfg->render_budget <= 0 && trim == NULL) {
+        bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+        output_buffer(bb, page);
+        APR_BRIGADE_INSERT_TAIL(bb,
+                                apr_bucket_flush_create(bb->bucket_alloc));
+
+        start = apr_time_now();
+        rv = ap_pass_brigade(r->output_filters, bb);
+        timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+        apr_brigade_cleanup(bb);
+        if (rv != APR_SUCCESS) {
+            hoedown_buffer_free(page);
+            hoedown_buffer_free(ib);
+            return AP_FILTER_ERROR;
+        }
+    }
+
+    /*
+     * A section cut out of the page of the document: its toc is the one
+     * of its own markdown, as for a section rendered alone, and the toc
+     * of the document goes with the rest of the page.
+     */
+    if (size > 0 && trim) {
+        rendered = render_body(r, cfg, toc, data, size, 0, NULL, page);
+    }
+    if (size > 0 && rendered) {
+        body_offset = page->size;
+        rendered = render_body(r, cfg, toc, source, source_size, !toc_only,
+                               bb, page);
+        if (rendered && trim) {
+            section_trim(r->pool, page, body_offset, trim);
+        }
+    }
+    if (admitted) {
+        apr_pool_cleanup_run(r->pool, &hoedown_renders, render_leave);
+    }
+
+    /* out of its budget: the markdown as it is, where HoedownRaw is on */
+    if (!rendered) {
+        hoedown_buffer_free(page);
+        if (cfg->raw == 0) {
+            hoedown_buffer_free(ib);
+            apr_table_setn(r->err_headers_out, "Retry-After", "1");
+            return HTTP_SERVICE_UNAVAILABLE;
+        }
+        output_text_headers(r, size);
+        start = apr_time_now();
+        ap_rwrite(data, size, r);
+        timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+        hoedown_buffer_free(ib);
+        return OK;
+    }
+
+    /* cleanup */
+    hoedown_buffer_free(ib);
+
+    if (bb) {
+        hoedown_buffer_free(page);
+
+        /* output style footer */
+        output_footer(r, bb, style_template);
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+
+        start = apr_time_now();
+        rv = ap_pass_brigade(r->output_filters, bb);
+        timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+        if (rv != APR_SUCCESS) {
+            return AP_FILTER_ERROR;
+        }
+
+        return OK;
+    }
+
+    /* output style footer */
+    hoedown_style_footer(page, style_template);
+
+    if (key) {
+        cache_store(r, cfg, key, page->data, page->size);
+    }
+    if (coalesce) {
+        flight_finish(coalesce, page->data, page->size);
+    }
+
+    output_page(r, cfg, key, encoding, page->data, page->size);
+
+    hoedown_buffer_free(page);
+
+    return OK;
+}
+
+/* content handler */
+static int
+hoedown_handler(request_rec *r)
+{
+    apr_pool_t *arena;
+    int ret;
+
+    if (strcmp(r->handler, "hoedown")) {
+        return DECLINED;
+    }
+
+    /* hoedown buffers and parser state of the request live in its pool */
+    arena = hoedown_arena_set(r->pool);
+    ret = page_handler(r);
+    hoedown_arena_set(arena);
+
+    return ret;
+}
+
+/*
+ * Prewarm: when a generation starts, one child renders the files of
+ * HoedownPrewarm into the render cache, on a thread of its own and at
+ * most HoedownPrewarmRate renders a second. Each file is served to a
+ * sub-request of its own, with the config a GET of it gets, so the pages
+ * cached are the ones served.
+ */
+static apr_status_t
+prewarm_filter(ap_filter_t * UNUSED(f), apr_bucket_brigade *bb)
+{
+    apr_brigade_cleanup(bb);
+    return APR_SUCCESS;
+}
+
+/*
+ * A GET of filename: a sub-request of its directory, the uri of which is
+ * its path under the DocumentRoot, so that its config is the one of the
+ * <Location>, <Directory> and <Files> sections of that uri. Its status is
+ * not HTTP_OK when the lookup failed.
+ */
+static request_rec *
+prewarm_request(apr_pool_t *p, hoedown_prewarm_t *prewarm,
+                char const *filename)
+{
+    conn_rec *c;
+    request_rec *r, *rnew;
+    ap_filter_t *sink;
+    char const *root;
+    char *dir;
+    apr_size_t len;
+
+    c = apr_pcalloc(p, sizeof(conn_rec));
+    c->pool = p;
+    c->base_server = prewarm->server;
+    c->bucket_alloc = apr_bucket_alloc_create(p);
+    c->conn_config = ap_create_conn_config(p);
+    c->notes = apr_table_make(p, 1);
+    c->client_ip = "127.0.0.1";
+    c->local_ip = "127.0.0.1";
+
+    r = apr_pcalloc(p, sizeof(request_rec));
+    r->pool = p;
+    r->connection = c;
+    r->server = prewarm->server;
+    r->request_time = apr_time_now();
+    r->the_request = "GET (prewarm)";
+    r->method = "GET";
+    r->method_number = M_GET;
+    r->protocol = "INCLUDED";
+    r->proto_num = HTTP_VERSION(1, 1);
+    r->status = HTTP_OK;
+    r->allowed_methods = ap_make_method_list(p, 2);
+    r->headers_in = apr_table_make(p, 1);
+    r->headers_out = apr_table_make(p, 8);
+    r->err_headers_out = apr_table_make(p, 1);
+    r->subprocess_env = apr_table_make(p, 1);
+    r->notes = apr_table_make(p, 1);
+    r->useragent_ip = c->client_ip;
+    r->per_dir_config = prewarm->server->lookup_defaults;
+    r->request_config = ap_create_request_config(p);
+
+    ap_run_create_request(r);
+
+    /* the directory, with its uri when it is under the DocumentRoot */
+    dir = ap_make_dirstr_parent(p, filename);
+    r->filename = dir;
+    r->canonical_filename = r->filename;
+    r->uri = "";
+    root = ap_document_root(r);
+    len = root ? strlen(root) : 0;
+    while (len > 0 && root[len - 1] == '/') {
+        len--;
+    }
+    if (len > 0 && strncmp(dir, root, len) == 0 && dir[len] == '/') {
+        r->uri = dir + len;
+    }
+
+    /* the page goes nowhere */
+    sink = ap_add_output_filter_handle(hoedown_prewarm.sink, NULL, r, c);
+
+    rnew = ap_sub_req_lookup_file(filename + strlen(dir), r, sink);
+    if (rnew->status != HTTP_OK) {
+        return rnew;
+    }
+
+    rnew->handler = "hoedown";
+    if (prewarm->style) {
+        rnew->args = apr_pstrcat(p, "style=",
+                                 ap_escape_urlencoded(p, prewarm->style),
+                                 NULL);
+    }
+
+    return rnew;
+}
+
+/* the files matched by the globs, and their style */
+static apr_array_header_t *
+prewarm_files(apr_pool_t *p, server_rec *s)
+{
+    apr_array_header_t *files, *names;
+    hoedown_prewarm_t *globs, *file;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    char *dir;
+    int i, j;
+
+    files = apr_array_make(p, 64, sizeof(hoedown_prewarm_t));
+
+    globs = (hoedown_prewarm_t *)hoedown_prewarm.globs->elts;
+    for (i = 0; i < hoedown_prewarm.globs->nelts; i++) {
+        /* wildcards in the last component only */
+        rv = apr_match_glob(globs[i].pattern, &names, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                         "hoedown: prewarm: cannot read %s",
+                         globs[i].pattern);
+            continue;
+        }
+
+        dir = ap_make_dirstr_parent(p, globs[i].pattern);
+        for (j = 0; j < names->nelts; j++) {
+            char const *filename;
+
+            filename = apr_pstrcat(p, dir, APR_ARRAY_IDX(names, j, char *),
+                                   NULL);
+            if (apr_stat(&finfo, filename, APR_FINFO_TYPE, p) != APR_SUCCESS
+                || finfo.filetype != APR_REG) {
+                continue;
+            }
+
+            file = apr_array_push(files);
+            file->server = globs[i].server;
+            file->pattern = filename;
+            file->style = globs[i].style;
+        }
+    }
+
+    return files;
+}
+
+/* sleep up to until, or less when the child stops */
+static void
+prewarm_wait(apr_time_t until)
+{
+    apr_time_t now;
+
+    while (!apr_atomic_read32(&hoedown_prewarm.stop)
+           && (now = apr_time_now()) < until) {
+        apr_sleep(until - now < HOEDOWN_PREWARM_POLL
+                  ? until - now : HOEDOWN_PREWARM_POLL);
+    }
+}
+
+static void
+prewarm_run(apr_pool_t *p, server_rec *s)
+{
+    apr_array_header_t *files;
+    hoedown_prewarm_t *file;
+    apr_pool_t *rp;
+    apr_time_t begin, start;
+    apr_interval_time_t interval = 0;
+    int i, ret, failed = 0;
+
+    files = prewarm_files(p, s);
+    file = (hoedown_prewarm_t *)files->elts;
+
+    if (hoedown_prewarm.rate > 0) {
+        interval = apr_time_from_sec(1) / hoedown_prewarm.rate;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, s,
+                 "hoedown: prewarming %d pages", files->nelts);
+
+    apr_pool_create(&rp, p);
+    begin = apr_time_now();
+
+    for (i = 0; i < files->nelts; i++) {
+        request_rec *r;
+        char const *cache = NULL;
+
+        if (apr_atomic_read32(&hoedown_prewarm.stop)) {
+            break;
+        }
+
+        start = apr_time_now();
+
+        r = prewarm_request(rp, &file[i], file[i].pattern);
+        if (r->status != HTTP_OK) {
+            ret = r->status;
+        } else {
+            ret = hoedown_handler(r);
+            cache = timing_get(r)->cache;
+        }
+        if (ret != OK) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                         "hoedown: prewarm: %s: status %d",
+                         file[i].pattern, ret);
+            failed++;
+        }
+        apr_pool_clear(rp);
+
+        if ((i + 1) % HOEDOWN_PREWARM_PROGRESS == 0) {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                         "hoedown: prewarm: %d of %d pages",
+                         i + 1, files->nelts);
+        }
+
+        /* pages already cached cost no render */
+        if (interval > 0 && (cache == NULL || strcmp(cache, "hit") != 0)) {
+            prewarm_wait(start + interval);
+        }
+    }
+
+    apr_pool_destroy(rp);
+
+    if (i < files->nelts) {
+        ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, s,
+                     "hoedown: prewarm stopped after %d of %d pages",
+                     i, files->nelts);
+
+        /* the next child starts it again */
+        if (hoedown_stats.data) {
+            apr_atomic_set32(&hoedown_stats.data->prewarm, 0);
+        }
+        return;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, s,
+                 "hoedown: prewarmed %d pages in %" APR_TIME_T_FMT
+                 " ms, %d failed", files->nelts - failed,
+                 apr_time_as_msec(apr_time_now() - begin), failed);
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC
+prewarm_thread(apr_thread_t *thread, void *data)
+{
+    prewarm_run(data, ap_server_conf);
+
+    apr_thread_exit(thread, APR_SUCCESS);
+
+    return NULL;
+}
+
+/* before the pools the thread uses are gone */
+static apr_status_t
+prewarm_stop(void * UNUSED(data))
+{
+    apr_status_t rv;
+
+    if (hoedown_prewarm.thread) {
+        apr_atomic_set32(&hoedown_prewarm.stop, 1);
+        apr_thread_join(&rv, hoedown_prewarm.thread);
+        hoedown_prewarm.thread = NULL;
+    }
+
+    return APR_SUCCESS;
+}
+#endif
+
+static void
+prewarm_start(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_allocator_t *allocator;
+    apr_pool_t *pool;
+    apr_status_t rv;
+#endif
+
+    if (hoedown_prewarm.globs == NULL || hoedown_cache.provider == NULL) {
+        return;
+    }
+
+    /* one child of the generation */
+    if (hoedown_stats.data
+        && apr_atomic_cas32(&hoedown_stats.data->prewarm, 1, 0) != 0) {
+        return;
+    }
+
+    apr_atomic_set32(&hoedown_prewarm.stop, 0);
+
+#if APR_HAS_THREADS
+    /* the thread allocates from pools of its own */
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&pool, p, NULL, allocator);
+    apr_allocator_owner_set(allocator, pool);
+
+    rv = apr_thread_create(&hoedown_prewarm.thread, NULL, prewarm_thread,
+                           pool, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "hoedown: failed to start the prewarm thread");
+        hoedown_prewarm.thread = NULL;
+        if (hoedown_stats.data) {
+            apr_atomic_set32(&hoedown_stats.data->prewarm, 0);
+        }
+        return;
+    }
+    apr_pool_pre_cleanup_register(p, NULL, prewarm_stop);
+#else
+    prewarm_run(p, s);
+#endif
+}
+
+/*
+ * Output filter: markdown produced by another handler (proxy, cgi, ...)
+ * is collected up to EOS and rendered with the same style and toc.
+ */
+typedef struct {
+    apr_bucket_brigade *bb;
+    apr_off_t size;
+} hoedown_filter_ctx_t;
+
+static apr_status_t
+hoedown_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    request_rec *r = f->r;
+    hoedown_filter_ctx_t *ctx = f->ctx;
+    hoedown_config_rec *cfg;
+    hoedown_style_t *style_template;
+    hoedown_buffer *page;
+    apr_finfo_t style_finfo;
+    apr_bucket_brigade *out;
+    apr_bucket *e;
+    const apr_table_t *args = NULL;
+    apr_off_t length;
+    apr_status_t rv;
+    apr_pool_t *arena;
+    char *style = NULL, *style_path, *toc = NULL;
+    const char *data = NULL;
+    apr_size_t size = 0;
+    int eos = 0, buckets = 0;
+    int ret = OK, admitted = 0, rendered = 1;
+    hoedown_timing_t *timing;
+    apr_time_t start;
+
+    if (ctx == NULL) {
+        /* rendered already, or nothing we can read */
+        if ((r->handler && strcmp(r->handler, "hoedown") == 0)
+            || apr_table_get(r->headers_out, "Content-Encoding")) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        ap_set_content_type(r, HOEDOWN_CONTENT_TYPE);
+        apr_table_unset(r->headers_out, "Content-Length");
+        apr_table_unset(r->headers_out, "ETag");
+
+        if (r->header_only) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        ctx = f->ctx = apr_pcalloc(r->pool, sizeof(hoedown_filter_ctx_t));
+        ctx->bb = apr_brigade_create(r->pool, f->c->bucket_alloc);
+    }
+
+    /* config */
+    cfg = ap_get_module_config(r->per_dir_config, &hoedown_module);
+
+    /* too large to set aside: the upstream markdown as it is */
+    if (cfg->max_input_size > 0
+        && apr_brigade_length(bb, 1, &length) == APR_SUCCESS
+        && (ctx->size += length) > cfg->max_input_size) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                      "hoedown: %s is larger than HoedownMaxInputSize, "
+                      "sent as it is", r->uri);
+        ap_set_content_type(r, "text/plain");
+        ap_remove_output_filter(f);
+        APR_BRIGADE_CONCAT(ctx->bb, bb);
+        return ap_pass_brigade(f->next, ctx->bb);
+    }
+
+    for (e = APR_BRIGADE_FIRST(bb);
+         e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e)) {
+        if (APR_BUCKET_IS_EOS(e)) {
+            eos = 1;
+            break;
+        }
+    }
+
+    if (!eos) {
+        return ap_save_brigade(f, &ctx->bb, &bb, r->pool);
+    }
+
+    /* the last brigade is used as is, without setting it aside */
+    APR_BRIGADE_CONCAT(ctx->bb, bb);
+
+    for (e = APR_BRIGADE_FIRST(ctx->bb);
+         e != APR_BRIGADE_SENTINEL(ctx->bb);
+         e = APR_BUCKET_NEXT(e)) {
+        if (!APR_BUCKET_IS_METADATA(e)) {
+            buckets++;
+        }
+    }
+
+    timing = timing_get(r);
+    timing->document = r->filename;
+    start = apr_time_now();
+
+    /*
+     * A single bucket of memory is read in place. Anything else is read to
+     * the end and joined once: a pipe (cgi) or a file bucket gives one
+     * chunk a read.
+     */
+    e = APR_BRIGADE_FIRST(ctx->bb);
+    while (e != APR_BRIGADE_SENTINEL(ctx->bb) && APR_BUCKET_IS_METADATA(e)) {
+        e = APR_BUCKET_NEXT(e);
+    }
+    if (buckets == 1 && e->length != (apr_size_t)-1
+        && (APR_BUCKET_IS_HEAP(e) || APR_BUCKET_IS_POOL(e)
+            || APR_BUCKET_IS_IMMORTAL(e))) {
+        rv = apr_bucket_read(e, &data, &size, APR_BLOCK_READ);
+    } else if (buckets > 0) {
+        char *flat;
+        rv = apr_brigade_pflatten(ctx->bb, &flat, &size, r->pool);
+        data = flat;
+    } else {
+        rv = APR_SUCCESS;
+    }
+    timing_add(timing, HOEDOWN_PHASE_READ, apr_time_now() - start);
+    timing->bytes_in = size;
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                      "hoedown: failed to read markdown from upstream");
+        apr_brigade_cleanup(ctx->bb);
+        return rv;
+    }
+
+    /* get parameter: the query string only, the body is not ours */
+    if (r->args && *r->args) {
+        apreq_args(apreq_handle_apache2(r), &args);
+    }
+    if (args) {
+        style = (char *)apreq_params_as_string(r->pool, args,
+                                               "style", APREQ_JOIN_AS_IS);
+        if (cfg->html & HOEDOWN_HTML_TOC) {
+            toc = (char *)apr_table_get(args, "toc");
+        }
+    }
+
+    /* style */
+    style_path = style_resolve(r, cfg, style, &style_finfo);
+
+    out = apr_brigade_create(r->pool, f->c->bucket_alloc);
+
+    arena = hoedown_arena_set(r->pool);
+
+    start = apr_time_now();
+    page = hoedown_buffer_new(HOEDOWN_PAGE_UNIT);
+    style_template = style_header(r, page, style_path, &style_finfo,
+                                  r->filename);
+    timing_add(timing, HOEDOWN_PHASE_STYLE, apr_time_now() - start);
+    output_buffer(out, page);
+    hoedown_buffer_free(page);
+
+    if (size > 0) {
+        ret = render_admit(r, &admitted);
+    }
+    if (size > 0 && ret == OK) {
+        rendered = render_body(r, cfg, toc, (const uint8_t *)data, size, 1,
+                               out, NULL);
+        if (admitted) {
+            apr_pool_cleanup_run(r->pool, &hoedown_renders, render_leave);
+        }
+    }
+
+    if (ret != OK || !rendered) {
+        hoedown_arena_set(arena);
+        apr_brigade_cleanup(out);
+        ap_remove_output_filter(f);
+
+        /* out of its budget: the upstream markdown as it is */
+        if (ret == OK) {
+            output_text_headers(r, size);
+            return ap_pass_brigade(f->next, ctx->bb);
+        }
+
+        apr_brigade_cleanup(ctx->bb);
+        APR_BRIGADE_INSERT_TAIL(out, ap_bucket_error_create(
+                                    ret, NULL, r->pool, out->bucket_alloc));
+        APR_BRIGADE_INSERT_TAIL(out, apr_bucket_eos_create(out->bucket_alloc));
+        return ap_pass_brigade(f->next, out);
+    }
+
+    /* upstream data is no longer referenced */
+    apr_brigade_cleanup(ctx->bb);
+
+    hoedown_arena_set(arena);
+
+    output_footer(r, out, style_template);
+    APR_BRIGADE_INSERT_TAIL(out, apr_bucket_eos_create(out->bucket_alloc));
+
+    if (apr_brigade_length(out, 1, &length) == APR_SUCCESS) {
+        ap_set_content_length(r, length);
+    }
+
+    ap_remove_output_filter(f);
+
+    start = apr_time_now();
+    rv = ap_pass_brigade(f->next, out);
+    timing_add(timing, HOEDOWN_PHASE_WRITE, apr_time_now() - start);
+
+    return rv;
+}
+
+/*
+ * Render statistics: the phase timings of a request are put in its notes
+ * when it is logged, and added to the aggregates shown by the
+ * hoedown-status handler.
+ */
+static apr_uint32_t
+stats_bucket(apr_interval_time_t elapsed)
+{
+    apr_uint32_t i = 0;
+
+    while (i < HOEDOWN_STATS_BUCKETS - 1
+           && elapsed > ((apr_interval_time_t)1 << i)) {
+        i++;
+    }
+
+    return i;
+}
+
+static void
+stats_largest(hoedown_stats_t *stats, char const *name, apr_size_t bytes)
+{
+    apr_uint32_t size, hash, cur, min = APR_UINT32_MAX;
+    apr_ssize_t len = strlen(name);
+    int i, slot = 0;
+
+    size = bytes > APR_UINT32_MAX ? APR_UINT32_MAX : (apr_uint32_t)bytes;
+    hash = apr_hashfunc_default(name, &len) | 1;
+
+    for (i = 0; i < HOEDOWN_STATS_LARGEST; i++) {
+        cur = apr_atomic_read32(&stats->largest[i].size);
+        if (apr_atomic_read32(&stats->largest[i].hash) == hash) {
+            /* already listed */
+            while (cur < size
+                   && apr_atomic_cas32(&stats->largest[i].size,
+                                       size, cur) != cur) {
+                cur = apr_atomic_read32(&stats->largest[i].size);
+            }
+            return;
+        }
+        if (cur < min) {
+            min = cur;
+            slot = i;
+        }
+    }
+
+    /* replace the smallest, unless another request got there first */
+    if (size <= min
+        || apr_atomic_cas32(&stats->largest[slot].size, size, min) != min) {
+        return;
+    }
+
+    apr_atomic_set32(&stats->largest[slot].hash, 0);
+    apr_cpystrn(stats->largest[slot].name, name, HOEDOWN_STATS_NAME_MAX);
+    apr_atomic_set32(&stats->largest[slot].hash, hash);
+}
+
+static int
+hoedown_log_transaction(request_rec *r)
+{
+    hoedown_timing_t *timing = NULL;
+    hoedown_stats_t *stats = hoedown_stats.data;
+    int i;
+
+    /* the request that was handled, after internal redirects */
+    for (; r; r = r->next) {
+        timing = ap_get_module_config(r->request_config, &hoedown_module);
+        if (timing) {
+            break;
+        }
+    }
+    if (timing == NULL) {
+        return DECLINED;
+    }
+
+    for (i = 0; i < HOEDOWN_PHASE_MAX; i++) {
+        if (!(timing->measured & (1 << i))) {
+            continue;
+        }
+        apr_table_setn(r->notes,
+                       apr_pstrcat(r->pool, "hoedown-", hoedown_phases[i],
+                                   "-us", NULL),
+                       apr_psprintf(r->pool, "%" APR_TIME_T_FMT,
+                                    timing->phases[i]));
+        if (stats) {
+            apr_atomic_inc32(
+                &stats->phases[i][stats_bucket(timing->phases[i])]);
+        }
+    }
+
+    apr_table_setn(r->notes, "hoedown-bytes-in",
+                   apr_psprintf(r->pool, "%" APR_SIZE_T_FMT,
+                                timing->bytes_in));
+    apr_table_setn(r->notes, "hoedown-bytes-out",
+                   apr_psprintf(r->pool, "%" APR_OFF_T_FMT, r->bytes_sent));
+    if (timing->cache) {
+        apr_table_setn(r->notes, "hoedown-cache", timing->cache);
+    }
+
+    if (stats == NULL) {
+        return DECLINED;
     }
 
-    /* default toc level */
-    toc_begin = cfg->toc.begin;
-    toc_end = cfg->toc.end;
-
-    if (ib->size > 0) {
-        if (cfg->raw != 0 && raw != NULL) {
-            r->content_type = "text/plain";
-            ap_rwrite(ib->data, ib->size, r);
-            hoedown_buffer_free(ib);
-            return OK;
+    apr_atomic_inc32(&stats->requests);
+    if (timing->measured & (1 << HOEDOWN_PHASE_RENDER)) {
+        apr_atomic_inc32(&stats->renders);
+    }
+    if (r->status == HTTP_NOT_MODIFIED) {
+        apr_atomic_inc32(&stats->not_modified);
+    }
+    if (timing->cache) {
+        if (strcmp(timing->cache, "hit") == 0) {
+            apr_atomic_inc32(&stats->cache_hits);
+        } else if (strcmp(timing->cache, "miss") == 0) {
+            apr_atomic_inc32(&stats->cache_misses);
+        } else if (strcmp(timing->cache, "coalesced") == 0) {
+            apr_atomic_inc32(&stats->coalesced);
+        } else {
+            apr_atomic_inc32(&stats->sidecar_hits);
         }
+    }
+    if (timing->document && timing->bytes_in > 0) {
+        stats_largest(stats, timing->document, timing->bytes_in);
+    }
 
-        /* output style header */
-        fp = style_header(r, cfg, style, r->filename);
+    return DECLINED;
+}
 
-        /* performing markdown parsing */
-        ob = hoedown_buffer_new(HOEDOWN_OUTPUT_UNIT);
+/* status handler: aggregates as "name{labels} value" lines */
+static int
+hoedown_status_handler(request_rec *r)
+{
+    hoedown_stats_t *stats = hoedown_stats.data;
+    apr_uint32_t hits, misses, count;
+    int i, j;
 
-        /* toc */
-        if (cfg->html & HOEDOWN_HTML_TOC) {
-            if (toc) {
-                size_t len = strlen(toc);
-                int n;
-
-                if (len > 0) {
-                    char *delim, *toc_b = NULL, *toc_e = NULL;
-                    delim = strstr(toc, ":");
-                    if (delim) {
-                        int i = delim - toc;
-                        toc_b = apr_pstrndup(r->pool, toc, i++);
-                        n = atoi(toc_b);
-                        if (n) {
-                            toc_begin = n;
-                        }
-
-                        toc_e = apr_pstrndup(r->pool, toc + i, len - i);
-                        n = atoi(toc_e);
-                        if (n) {
-                            toc_end = n;
-                        }
-                    } else {
-                        n = atoi(toc);
-                        if (n) {
-                            toc_begin = n;
-                        }
-                    }
-                }
-            }
+    if (strcmp(r->handler, "hoedown-status")) {
+        return DECLINED;
+    }
 
-            renderer = hoedown_html_toc_renderer_new(0);
-            state = (hoedown_html_renderer_state *)renderer->opaque;
+    r->allowed = (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
 
-            state->flags = cfg->html;
-            state->toc_data.level_offset = toc_begin;
-            state->toc_data.nesting_level = toc_end;
-#ifdef HOEDOWN_VERSION_EXTRAS
-            state->toc_data.header = cfg->toc.header;
-            state->toc_data.footer = cfg->toc.footer;
-            state->toc_data.unescape = cfg->toc.unescape;
-#endif
+    if (stats == NULL) {
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
 
-            markdown = hoedown_document_new(renderer, cfg->extensions, 16);
+    ap_set_content_type(r, "text/plain; charset=utf-8");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
 
-            hoedown_document_render(markdown, ob, ib->data, ib->size);
+    if (r->header_only) {
+        return OK;
+    }
 
-            hoedown_document_free(markdown);
-            hoedown_html_renderer_free(renderer);
+    hits = apr_atomic_read32(&stats->cache_hits);
+    misses = apr_atomic_read32(&stats->cache_misses);
 
-            ap_rwrite(ob->data, ob->size, r);
+    ap_rprintf(r, "hoedown_requests_total %u\n",
+               apr_atomic_read32(&stats->requests));
+    ap_rprintf(r, "hoedown_renders_total %u\n",
+               apr_atomic_read32(&stats->renders));
+    ap_rprintf(r, "hoedown_not_modified_total %u\n",
+               apr_atomic_read32(&stats->not_modified));
+    ap_rprintf(r, "hoedown_sidecar_hits_total %u\n",
+               apr_atomic_read32(&stats->sidecar_hits));
+    ap_rprintf(r, "hoedown_coalesced_total %u\n",
+               apr_atomic_read32(&stats->coalesced));
+    ap_rprintf(r, "hoedown_cache_hits_total %u\n", hits);
+    ap_rprintf(r, "hoedown_cache_misses_total %u\n", misses);
+    ap_rprintf(r, "hoedown_cache_hit_ratio %.4f\n",
+               hits + misses > 0 ? (double)hits / (hits + misses) : 0.0);
 
-            hoedown_buffer_reset(ob);
+    /* cumulative, as histogram buckets usually are */
+    for (i = 0; i < HOEDOWN_PHASE_MAX; i++) {
+        count = 0;
+        for (j = 0; j < HOEDOWN_STATS_BUCKETS; j++) {
+            count += apr_atomic_read32(&stats->phases[i][j]);
+            if (j < HOEDOWN_STATS_BUCKETS - 1) {
+                ap_rprintf(r, "hoedown_phase_us_bucket"
+                           "{phase=\"%s\",le=\"%lu\"} %u\n",
+                           hoedown_phases[i], 1UL << j, count);
+            } else {
+                ap_rprintf(r, "hoedown_phase_us_bucket"
+                           "{phase=\"%s\",le=\"+Inf\"} %u\n",
+                           hoedown_phases[i], count);
+            }
         }
+        ap_rprintf(r, "hoedown_phase_us_count{phase=\"%s\"} %u\n",
+                   hoedown_phases[i], count);
+    }
 
-        /* markdown render */
-        renderer = hoedown_html_renderer_new(cfg->html, toc_end);
+    for (i = 0; i < HOEDOWN_STATS_LARGEST; i++) {
+        char name[HOEDOWN_STATS_NAME_MAX];
 
-#ifdef HOEDOWN_VERSION_EXTRAS
-        state = (hoedown_html_renderer_state *)renderer->opaque;
-        if ((state->flags & HOEDOWN_HTML_USE_TASK_LIST) && cfg->class.task) {
-            state->class_data.task = cfg->class.task;
-        }
-        if (cfg->class.ol) {
-            state->class_data.ol = cfg->class.ol;
-        }
-        if (cfg->class.ul) {
-            state->class_data.ul = cfg->class.ul;
+        if (apr_atomic_read32(&stats->largest[i].hash) == 0) {
+            continue;
         }
-#endif
-
-        markdown = hoedown_document_new(renderer, cfg->extensions, 16);
-
-        hoedown_document_render(markdown, ob, ib->data, ib->size);
-
-        hoedown_document_free(markdown);
-        hoedown_html_renderer_free(renderer);
-
-        /* writing the result */
-        ap_rwrite(ob->data, ob->size, r);
-
-        /* cleanup */
-        hoedown_buffer_free(ob);
-    } else {
-        /* output style header */
-        fp = style_header(r, cfg, style, r->filename);
+        apr_cpystrn(name, stats->largest[i].name, sizeof(name));
+        ap_rprintf(r, "hoedown_largest_document_bytes{document=\"%s\"} %u\n",
+                   ap_escape_quotes(r->pool, name),
+                   apr_atomic_read32(&stats->largest[i].size));
     }
 
-    /* cleanup */
-    hoedown_buffer_free(ib);
-
-    /* output style footer */
-    style_footer(r, fp);
-
     return OK;
 }
 
@@ -605,12 +5221,25 @@ hoedown_create_dir_config(apr_pool_t *p, char * UNUSED(dir))
     cfg->toc.header = NULL;
     cfg->toc.footer = NULL;
     cfg->toc.unescape = 0;
+    cfg->cache.ttl = HOEDOWN_CACHE_TTL;
+    cfg->cache.max_entry = HOEDOWN_CACHE_ENTRY_MAX;
+    cfg->compression = 0;
+    cfg->prerendered = 0;
+    cfg->mmap_threshold = HOEDOWN_MMAP_THRESHOLD;
+    cfg->max_nesting = HOEDOWN_MAX_NESTING;
+    cfg->coalesce = HOEDOWN_COALESCE_TIMEOUT;
+    cfg->max_input_size = HOEDOWN_MAX_INPUT_SIZE;
+    cfg->incremental = HOEDOWN_INCREMENTAL;
+    cfg->parallel = HOEDOWN_PARALLEL;
+    cfg->stat_interval = HOEDOWN_STAT_INTERVAL;
+    cfg->render_budget = HOEDOWN_RENDER_BUDGET;
+    cfg->url.timeout = HOEDOWN_URL_TIMEOUT;
+    cfg->url.max_size = HOEDOWN_URL_MAX_SIZE;
+    cfg->url.cache_ttl = HOEDOWN_URL_CACHE_TTL;
+    cfg->url.allow = NULL;
     cfg->raw = 0;
     cfg->html = 0;
-    cfg->extensions =
-        HOEDOWN_EXT_TABLES | HOEDOWN_EXT_FENCED_CODE |
-        HOEDOWN_EXT_AUTOLINK | HOEDOWN_EXT_STRIKETHROUGH |
-        HOEDOWN_EXT_NO_INTRA_EMPHASIS;
+    cfg->extensions = HOEDOWN_EXTENSIONS_DEFAULT;
 
     return (void *)cfg;
 }
@@ -695,6 +5324,98 @@ hoedown_merge_dir_config(apr_pool_t *p, void *base_conf, void *override_conf)
     }
 #endif
 
+    if (override->cache.ttl != HOEDOWN_CACHE_TTL) {
+        cfg->cache.ttl = override->cache.ttl;
+    } else {
+        cfg->cache.ttl = base->cache.ttl;
+    }
+    if (override->cache.max_entry != HOEDOWN_CACHE_ENTRY_MAX) {
+        cfg->cache.max_entry = override->cache.max_entry;
+    } else {
+        cfg->cache.max_entry = base->cache.max_entry;
+    }
+
+    if (override->compression != 0) {
+        cfg->compression = 1;
+    } else {
+        cfg->compression = base->compression;
+    }
+
+    if (override->prerendered != 0) {
+        cfg->prerendered = 1;
+    } else {
+        cfg->prerendered = base->prerendered;
+    }
+
+    if (override->mmap_threshold != HOEDOWN_MMAP_THRESHOLD) {
+        cfg->mmap_threshold = override->mmap_threshold;
+    } else {
+        cfg->mmap_threshold = base->mmap_threshold;
+    }
+
+    if (override->max_nesting != HOEDOWN_MAX_NESTING) {
+        cfg->max_nesting = override->max_nesting;
+    } else {
+        cfg->max_nesting = base->max_nesting;
+    }
+
+    if (override->max_input_size != HOEDOWN_MAX_INPUT_SIZE) {
+        cfg->max_input_size = override->max_input_size;
+    } else {
+        cfg->max_input_size = base->max_input_size;
+    }
+
+    if (override->incremental != HOEDOWN_INCREMENTAL) {
+        cfg->incremental = override->incremental;
+    } else {
+        cfg->incremental = base->incremental;
+    }
+
+    if (override->parallel != HOEDOWN_PARALLEL) {
+        cfg->parallel = override->parallel;
+    } else {
+        cfg->parallel = base->parallel;
+    }
+
+    if (override->stat_interval != HOEDOWN_STAT_INTERVAL) {
+        cfg->stat_interval = override->stat_interval;
+    } else {
+        cfg->stat_interval = base->stat_interval;
+    }
+
+    if (override->render_budget != HOEDOWN_RENDER_BUDGET) {
+        cfg->render_budget = override->render_budget;
+    } else {
+        cfg->render_budget = base->render_budget;
+    }
+
+    if (override->coalesce != HOEDOWN_COALESCE_TIMEOUT) {
+        cfg->coalesce = override->coalesce;
+    } else {
+        cfg->coalesce = base->coalesce;
+    }
+
+    if (override->url.timeout != HOEDOWN_URL_TIMEOUT) {
+        cfg->url.timeout = override->url.timeout;
+    } else {
+        cfg->url.timeout = base->url.timeout;
+    }
+    if (override->url.max_size != HOEDOWN_URL_MAX_SIZE) {
+        cfg->url.max_size = override->url.max_size;
+    } else {
+        cfg->url.max_size = base->url.max_size;
+    }
+    if (override->url.cache_ttl != HOEDOWN_URL_CACHE_TTL) {
+        cfg->url.cache_ttl = override->url.cache_ttl;
+    } else {
+        cfg->url.cache_ttl = base->url.cache_ttl;
+    }
+    if (override->url.allow) {
+        cfg->url.allow = override->url.allow;
+    } else {
+        cfg->url.allow = base->url.allow;
+    }
+
     if (override->raw != 0) {
         cfg->raw = 1;
     } else {
@@ -773,6 +5494,222 @@ HOEDOWN_SET_RENDER(usetasklist, HOEDOWN_HTML_USE_TASK_LIST);
 HOEDOWN_SET_RENDER(linecontinue, HOEDOWN_HTML_LINE_CONTINUE);
 #endif
 
+#ifdef HOEDOWN_URL_SUPPORT
+static const char *
+hoedown_set_url_allow(cmd_parms *parms, void *mconfig, const char *arg)
+{
+    hoedown_config_rec *cfg = (hoedown_config_rec *)mconfig;
+
+    if (cfg->url.allow == NULL) {
+        cfg->url.allow = apr_array_make(parms->pool, 4, sizeof(char *));
+    }
+    *(const char **)apr_array_push(cfg->url.allow) = arg;
+
+    return NULL;
+}
+#endif
+
+static const char *
+hoedown_set_cache(cmd_parms *parms, void * UNUSED(mconfig), const char *arg)
+{
+    const char *err, *sep, *name;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    /* argument: provider[:args] */
+    sep = ap_strchr_c(arg, ':');
+    if (sep) {
+        name = apr_pstrmemdup(parms->pool, arg, sep - arg);
+        hoedown_cache.args = apr_pstrdup(parms->pool, sep + 1);
+    } else {
+        name = arg;
+        hoedown_cache.args = NULL;
+    }
+
+    hoedown_cache.provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP,
+                                                name,
+                                                AP_SOCACHE_PROVIDER_VERSION);
+    if (hoedown_cache.provider == NULL) {
+        return apr_psprintf(parms->pool,
+                            "Unknown socache provider '%s'. "
+                            "Maybe you need to load the appropriate "
+                            "socache module (mod_socache_%s?)",
+                            name, name);
+    }
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_cache_size(cmd_parms *parms, void * UNUSED(mconfig),
+                       const char *arg)
+{
+    const char *err;
+    apr_off_t size;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS || size <= 0) {
+        return "HoedownCacheSize must be a positive number of bytes";
+    }
+    hoedown_cache.size = (apr_size_t)size;
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_cache_max_entry(cmd_parms * UNUSED(parms), void *mconfig,
+                            const char *arg)
+{
+    hoedown_config_rec *cfg = mconfig;
+    char *end;
+    long size;
+
+    size = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || size <= 0
+        || size > APR_INT32_MAX) {
+        return "HoedownCacheMaxEntrySize must be a positive number of bytes";
+    }
+    cfg->cache.max_entry = (int)size;
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_parallel_threads(cmd_parms *parms, void * UNUSED(mconfig),
+                             const char *arg)
+{
+    const char *err;
+    char *end;
+    long threads;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    threads = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || threads < 0 || threads > 1024) {
+        return "HoedownParallelThreads must be a number of threads "
+            "(0 to 1024)";
+    }
+    hoedown_parallel.threads = (int)threads;
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_max_renders(cmd_parms *parms, void * UNUSED(mconfig),
+                        const char *arg, const char *timeout)
+{
+    const char *err;
+    char *end;
+    long renders, msec = HOEDOWN_RENDER_QUEUE;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    renders = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || renders < 0 || renders > 65536) {
+        return "HoedownMaxConcurrentRenders must be a number of renders "
+            "(0 for no limit)";
+    }
+
+    if (timeout) {
+        msec = strtol(timeout, &end, 10);
+        if (*timeout == '\0' || *end != '\0' || msec < 0
+            || msec > 3600000) {
+            return "HoedownMaxConcurrentRenders queue timeout must be "
+                "in milliseconds";
+        }
+    }
+
+    hoedown_renders.max = (int)renders;
+    hoedown_renders.timeout = (int)msec;
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_watch(cmd_parms *parms, void * UNUSED(mconfig), const char *arg)
+{
+    char *path;
+    apr_size_t len;
+
+    path = ap_server_root_relative(parms->pool, arg);
+    if (path == NULL) {
+        return apr_pstrcat(parms->pool, "HoedownWatch: invalid path ", arg,
+                           NULL);
+    }
+
+    len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+
+    if (hoedown_watch.trees == NULL) {
+        hoedown_watch.trees = apr_array_make(parms->pool, 4, sizeof(char *));
+    }
+    APR_ARRAY_PUSH(hoedown_watch.trees, char *) = path;
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_prewarm(cmd_parms *parms, void * UNUSED(mconfig),
+                    const char *pattern, const char *style)
+{
+    hoedown_prewarm_t *prewarm;
+
+    if (hoedown_prewarm.globs == NULL) {
+        hoedown_prewarm.globs = apr_array_make(parms->pool, 4,
+                                               sizeof(hoedown_prewarm_t));
+    }
+
+    prewarm = apr_array_push(hoedown_prewarm.globs);
+    prewarm->server = parms->server;
+    prewarm->pattern = ap_server_root_relative(parms->pool, pattern);
+    prewarm->style = style;
+
+    if (prewarm->pattern == NULL) {
+        return apr_pstrcat(parms->pool, "HoedownPrewarm: invalid path ",
+                           pattern, NULL);
+    }
+
+    return NULL;
+}
+
+static const char *
+hoedown_set_prewarm_rate(cmd_parms *parms, void * UNUSED(mconfig),
+                         const char *arg)
+{
+    const char *err;
+    char *end;
+    long rate;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    rate = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || rate < 0 || rate > 1000000) {
+        return "HoedownPrewarmRate must be a number of renders a second "
+            "(0 for no limit)";
+    }
+    hoedown_prewarm.rate = (int)rate;
+
+    return NULL;
+}
+
 static const command_rec
 hoedown_cmds[] = {
     AP_INIT_TAKE1("HoedownDefaultPage", ap_set_string_slot,
@@ -820,6 +5757,78 @@ hoedown_cmds[] = {
     AP_INIT_FLAG("HoedownTocUnescape", ap_set_flag_slot,
                  (void *)APR_OFFSETOF(hoedown_config_rec, toc.unescape),
                  OR_ALL, "hoedown toc unescape"),
+#endif
+    /* Cache options */
+    AP_INIT_TAKE1("HoedownCache", hoedown_set_cache,
+                  NULL, RSRC_CONF, "hoedown render cache provider[:args]"),
+    AP_INIT_TAKE1("HoedownCacheSize", hoedown_set_cache_size,
+                  NULL, RSRC_CONF, "hoedown render cache memory size"),
+    AP_INIT_TAKE1("HoedownCacheTTL", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, cache.ttl),
+                  OR_ALL, "hoedown render cache ttl (seconds)"),
+    AP_INIT_TAKE1("HoedownCacheMaxEntrySize", hoedown_set_cache_max_entry,
+                  NULL, OR_ALL, "hoedown render cache maximum entry size"),
+    AP_INIT_FLAG("HoedownCompression", ap_set_flag_slot,
+                 (void *)APR_OFFSETOF(hoedown_config_rec, compression),
+                 OR_ALL, "Enable hoedown pre-compressed output"),
+    AP_INIT_FLAG("HoedownPrerendered", ap_set_flag_slot,
+                 (void *)APR_OFFSETOF(hoedown_config_rec, prerendered),
+                 OR_ALL, "Enable hoedown pre-rendered sidecar pages"),
+    AP_INIT_TAKE1("HoedownCoalesceTimeout", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, coalesce),
+                  OR_ALL, "hoedown wait for a render in progress (msec)"),
+    /* Input options */
+    AP_INIT_TAKE1("HoedownMMapThreshold", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, mmap_threshold),
+                  OR_ALL, "hoedown file size from which input is mmap'ed"),
+    AP_INIT_TAKE1("HoedownMaxNesting", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, max_nesting),
+                  OR_ALL, "hoedown maximum block nesting depth"),
+    AP_INIT_TAKE1("HoedownMaxInputSize", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, max_input_size),
+                  OR_ALL, "hoedown maximum markdown input size"),
+    AP_INIT_TAKE1("HoedownIncremental", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, incremental),
+                  OR_ALL, "hoedown document size from which unchanged "
+                  "blocks are not rendered again"),
+    AP_INIT_TAKE1("HoedownParallelThreads", hoedown_set_parallel_threads,
+                  NULL, RSRC_CONF, "hoedown render threads per child"),
+    AP_INIT_TAKE1("HoedownParallelThreshold", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, parallel),
+                  OR_ALL, "hoedown document size from which it is "
+                  "rendered on the render threads"),
+    AP_INIT_TAKE12("HoedownMaxConcurrentRenders", hoedown_set_max_renders,
+                   NULL, RSRC_CONF, "hoedown renders at once per child, "
+                   "and the milliseconds a request waits for one"),
+    AP_INIT_TAKE1("HoedownRenderBudget", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, render_budget),
+                  OR_ALL, "hoedown milliseconds a render may take before "
+                  "the markdown is sent as it is"),
+    AP_INIT_ITERATE("HoedownWatch", hoedown_set_watch,
+                    NULL, RSRC_CONF, "hoedown directories watched for "
+                    "changes of their markdown files"),
+    AP_INIT_TAKE1("HoedownStatInterval", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, stat_interval),
+                  OR_ALL, "hoedown seconds a stat of a file not watched "
+                  "is used"),
+    AP_INIT_TAKE12("HoedownPrewarm", hoedown_set_prewarm,
+                   NULL, RSRC_CONF, "hoedown files rendered into the "
+                   "render cache at startup, and their style"),
+    AP_INIT_TAKE1("HoedownPrewarmRate", hoedown_set_prewarm_rate,
+                  NULL, RSRC_CONF, "hoedown prewarm renders a second"),
+#ifdef HOEDOWN_URL_SUPPORT
+    /* URL options */
+    AP_INIT_TAKE1("HoedownURLTimeout", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, url.timeout),
+                  OR_ALL, "hoedown url fetch timeout (seconds)"),
+    AP_INIT_TAKE1("HoedownURLMaxSize", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, url.max_size),
+                  OR_ALL, "hoedown url fetch maximum size"),
+    AP_INIT_TAKE1("HoedownURLCacheTTL", ap_set_int_slot,
+                  (void *)APR_OFFSETOF(hoedown_config_rec, url.cache_ttl),
+                  OR_ALL, "hoedown url fetch cache ttl (seconds)"),
+    AP_INIT_ITERATE("HoedownURLAllow", hoedown_set_url_allow,
+                    NULL, OR_ALL, "hoedown url hosts allowed to fetch"),
 #endif
     /* Raw options */
     AP_INIT_FLAG("HoedownRaw", ap_set_flag_slot,
@@ -900,10 +5909,269 @@ hoedown_cmds[] = {
     {NULL}
 };
 
+static int
+hoedown_pre_config(apr_pool_t *pconf, apr_pool_t * UNUSED(plog),
+                   apr_pool_t * UNUSED(ptemp))
+{
+    apr_status_t rv;
+
+    hoedown_cache.provider = NULL;
+    hoedown_cache.instance = NULL;
+    hoedown_cache.args = NULL;
+    hoedown_cache.size = HOEDOWN_CACHE_SIZE;
+
+    hoedown_prewarm.globs = NULL;
+    hoedown_prewarm.rate = HOEDOWN_PREWARM_RATE;
+
+    hoedown_watch.trees = NULL;
+
+    hoedown_renders.max = HOEDOWN_MAX_RENDERS;
+    hoedown_renders.timeout = HOEDOWN_RENDER_QUEUE;
+
+    rv = ap_mutex_register(pconf, HOEDOWN_CACHE_ID, NULL, APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    return OK;
+}
+
+static apr_status_t
+hoedown_cache_destroy(void *data)
+{
+    server_rec *s = data;
+
+    if (hoedown_cache.provider && hoedown_cache.instance) {
+        hoedown_cache.provider->destroy(hoedown_cache.instance, s);
+        hoedown_cache.instance = NULL;
+    }
+
+    return APR_SUCCESS;
+}
+
+/* render statistics: anonymous shared memory when available */
+static void
+hoedown_stats_create(apr_pool_t *pconf, server_rec *s)
+{
+    apr_status_t rv;
+    const char *file;
+
+    hoedown_stats.data = NULL;
+
+    rv = apr_shm_create(&hoedown_stats.shm, sizeof(hoedown_stats_t),
+                        NULL, pconf);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        file = ap_runtime_dir_relative(pconf, HOEDOWN_STATS_ID);
+        apr_shm_remove(file, pconf);
+        rv = apr_shm_create(&hoedown_stats.shm, sizeof(hoedown_stats_t),
+                            file, pconf);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "hoedown: failed to create statistics shared memory");
+        return;
+    }
+
+    hoedown_stats.data = apr_shm_baseaddr_get(hoedown_stats.shm);
+    memset(hoedown_stats.data, 0, sizeof(hoedown_stats_t));
+}
+
+static int
+hoedown_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                    apr_pool_t *ptemp, server_rec *s)
+{
+    apr_status_t rv;
+    const char *args, *err;
+    struct ap_socache_hints hints;
+
+    hoedown_stats_create(pconf, s);
+
+#ifndef HOEDOWN_WATCH
+    if (hoedown_watch.trees) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "hoedown: HoedownWatch needs inotify, "
+                     "HoedownStatInterval applies");
+    }
+#endif
+
+    if (hoedown_cache.provider == NULL) {
+        if (hoedown_prewarm.globs) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                         "hoedown: HoedownPrewarm without HoedownCache, "
+                         "nothing is prewarmed");
+        }
+        return OK;
+    }
+
+    args = hoedown_cache.args;
+    if (args == NULL && strcmp(hoedown_cache.provider->name, "shmcb") == 0) {
+        args = apr_psprintf(ptemp, "%s(%" APR_SIZE_T_FMT ")",
+                            ap_runtime_dir_relative(ptemp, "hoedown_cache"),
+                            hoedown_cache.size);
+    }
+
+    err = hoedown_cache.provider->create(&hoedown_cache.instance, args,
+                                         ptemp, pconf);
+    if (err) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s,
+                     "hoedown: failed to create cache: %s", err);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    rv = ap_global_mutex_create(&hoedown_cache.mutex, NULL, HOEDOWN_CACHE_ID,
+                                NULL, s, pconf, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog,
+                      "hoedown: failed to create %s mutex", HOEDOWN_CACHE_ID);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    hints.avg_id_len = APR_MD5_DIGESTSIZE * 2;
+    hints.avg_obj_size = HOEDOWN_CACHE_ENTRY_MAX / 16;
+    hints.expiry_interval = apr_time_from_sec(HOEDOWN_CACHE_TTL);
+
+    rv = hoedown_cache.provider->init(hoedown_cache.instance,
+                                      HOEDOWN_CACHE_ID, &hints, s, pconf);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s,
+                     "hoedown: failed to initialise %s cache",
+                     hoedown_cache.provider->name);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    apr_pool_cleanup_register(pconf, (void *)s, hoedown_cache_destroy,
+                              apr_pool_cleanup_null);
+
+    return OK;
+}
+
+static void
+hoedown_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+
+    /* style templates */
+    apr_pool_create(&hoedown_styles.pool, p);
+    hoedown_styles.hash = apr_hash_make(hoedown_styles.pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&hoedown_styles.mutex,
+                            APR_THREAD_MUTEX_DEFAULT, p);
+
+    /* render contexts, freed when their thread exits */
+    rv = apr_threadkey_private_create(&hoedown_contexts_key,
+                                      contexts_destroy, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "hoedown: failed to create render context key");
+        hoedown_contexts_key = NULL;
+    }
+#endif
+
+#if APR_HAS_THREADS
+    /* render slots */
+    hoedown_renders.active = 0;
+    if (hoedown_renders.max > 0
+        && (apr_thread_mutex_create(&hoedown_renders.mutex,
+                                    APR_THREAD_MUTEX_DEFAULT,
+                                    p) != APR_SUCCESS
+            || apr_thread_cond_create(&hoedown_renders.cond,
+                                      p) != APR_SUCCESS)) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "hoedown: failed to create render slots");
+        hoedown_renders.mutex = NULL;
+    }
+
+    /* render threads, started as needed */
+    if (hoedown_parallel.threads > 0) {
+        /* before the threads: they are gone first */
+        if (apr_thread_mutex_create(&hoedown_parallel.mutex,
+                                    APR_THREAD_MUTEX_DEFAULT,
+                                    p) != APR_SUCCESS
+            || apr_thread_cond_create(&hoedown_parallel.cond,
+                                      p) != APR_SUCCESS) {
+            hoedown_parallel.mutex = NULL;
+        }
+        rv = apr_thread_pool_create(&hoedown_parallel.pool, 0,
+                                    hoedown_parallel.threads, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                         "hoedown: failed to create render threads");
+            hoedown_parallel.pool = NULL;
+        }
+    }
+#endif
+
+    /* stat results, and the watched directories they depend on */
+    apr_pool_create(&hoedown_finfos.pool, p);
+    hoedown_finfos.hash = apr_hash_make(hoedown_finfos.pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&hoedown_finfos.mutex,
+                            APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+#ifdef HOEDOWN_WATCH
+    watch_start(p, s);
+#endif
+
+    /* heading indexes */
+    apr_pool_create(&hoedown_indexes.pool, p);
+    hoedown_indexes.hash = apr_hash_make(hoedown_indexes.pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&hoedown_indexes.mutex,
+                            APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+
+    /* rendered blocks */
+    apr_pool_create(&hoedown_incrementals.pool, p);
+    hoedown_incrementals.hash = apr_hash_make(hoedown_incrementals.pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&hoedown_incrementals.mutex,
+                            APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+
+    /* renders in progress */
+    apr_pool_create(&hoedown_flights.pool, p);
+    hoedown_flights.hash = apr_hash_make(hoedown_flights.pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&hoedown_flights.mutex,
+                            APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+
+#ifdef HOEDOWN_URL_SUPPORT
+    url_init(p, s);
+#endif
+
+    if (hoedown_cache.mutex == NULL) {
+        return;
+    }
+
+    rv = apr_global_mutex_child_init(&hoedown_cache.mutex,
+                                     apr_global_mutex_lockfile(
+                                         hoedown_cache.mutex), p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s,
+                     "hoedown: failed to initialise %s mutex in child",
+                     HOEDOWN_CACHE_ID);
+        return;
+    }
+
+    /* the render cache of the generation */
+    prewarm_start(p, s);
+}
+
 static void
 hoedown_register_hooks(apr_pool_t * UNUSED(p))
 {
+    ap_hook_pre_config(hoedown_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(hoedown_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(hoedown_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_handler(hoedown_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(hoedown_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_log_transaction(hoedown_log_transaction, NULL, NULL,
+                            APR_HOOK_FIRST);
+    ap_register_output_filter("HOEDOWN", hoedown_output_filter, NULL,
+                              AP_FTYPE_RESOURCE);
+    hoedown_prewarm.sink = ap_register_output_filter("HOEDOWN_PREWARM",
+                                                     prewarm_filter, NULL,
+                                                     AP_FTYPE_RESOURCE);
 }
 
 module AP_MODULE_DECLARE_DATA hoedown_module =